@@ -0,0 +1,3916 @@
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <new>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <fcntl.h>
+#include <linux/mempolicy.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/random.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#ifdef SLAB_USE_RSEQ
+#include <sys/rseq.h>
+#include <sys/sysinfo.h>
+#endif
+
+#include "slab.h"
+
+/* address space reserved for SLABs, pages are backed only when touched */
+const size_t arena_size = (size_t)16 << 30;
+
+/* size of a huge page of x86-64, both THP and MAP_HUGETLB */
+const size_t huge_page_size = (size_t)2 << 20;
+
+/* page_state flag of the first page of a free block, the low bits keep the block order */
+const uint8_t page_free = 0x80;
+
+/* page_state flag of the first page of a free block whose other pages were given back with MADV_DONTNEED */
+const uint8_t page_purged = 0x40;
+
+/**
+ * Free block of the buddy allocator linked
+ * in the list of its order
+ **/
+struct buddy_block {
+    buddy_block *previous;
+    buddy_block *next;
+};
+
+/**
+ * Buddy allocator of 4096 * 2^order byte blocks carved out
+ * of one reserved range. Blocks of order max_slab_order are
+ * taken from the range start on demand, smaller ones are
+ * split out of them. Freed blocks merge with their free buddies
+ **/
+struct page_arena {
+    std::mutex lock;
+    uint8_t *start; /* aligned on the largest block size */
+    size_t size;
+    size_t used; /* bytes of the range handed to the free lists so far */
+    buddy_block *free_blocks[max_slab_order + 1];
+    uint8_t *page_state; /* per page: order of the block starting there, page_free and page_purged */
+    slabStruct **page_slabs; /* per page: slabStruct of the SLAB holding it, nullptr for other pages */
+    std::atomic<uint8_t> *block_nodes; /* per max_slab_order block: 1 + the node its pages prefer, 0 if unbound */
+    size_t page_size; /* granularity of madvise, the first page of a free block keeps its links */
+    bool hugetlb; /* blocks taken from the range start are remapped from the MAP_HUGETLB pool */
+};
+
+/**
+ * Count of free pages of the MAP_HUGETLB pool, 0 if
+ * the pool is empty or /proc/meminfo can't be read
+ **/
+size_t free_hugetlb_pages() {
+    size_t pages = 0;
+    if (FILE *meminfo = fopen("/proc/meminfo", "r")) {
+        char line[128];
+        while (fgets(line, sizeof(line), meminfo)) {
+            if (sscanf(line, "HugePages_Free: %zu", &pages) == 1) {
+                break;
+            }
+        }
+        fclose(meminfo);
+    }
+    return pages;
+}
+
+/**
+ * Reserves the range of the arena. A huge arena asks for
+ * transparent huge pages with madvise(MADV_HUGEPAGE) and, while
+ * the MAP_HUGETLB pool has free pages, remaps every block it
+ * takes from the range start from the pool, see arena_grow
+ **/
+void arena_setup(page_arena *arena, size_t size, bool huge) {
+    size_t block_size = (size_t)4096 << max_slab_order;
+
+    // reserve extra to align the range start on the largest block size
+    uint8_t *start = nullptr;
+    auto reserved = (uint8_t*)mmap(nullptr, size + block_size, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (reserved != MAP_FAILED) {
+        start = (uint8_t*)(((uintptr_t)reserved + block_size - 1) & ~(block_size - 1));
+        if (start != reserved) {
+            munmap(reserved, start - reserved);
+        }
+        munmap(start + size, reserved + block_size - start);
+
+        if (huge) {
+            madvise(start, size, MADV_HUGEPAGE);
+        }
+    }
+
+    auto page_state = (uint8_t*)mmap(nullptr, size / 4096, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    // the page map, like page state, is backed only where SLABs are
+    auto page_slabs = (slabStruct**)mmap(nullptr, size / 4096 * sizeof(slabStruct*), PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    auto block_nodes = (std::atomic<uint8_t>*)mmap(nullptr, size / block_size, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+    if (!start || page_state == MAP_FAILED || page_slabs == MAP_FAILED || block_nodes == MAP_FAILED) {
+        arena->start = nullptr;
+        arena->size = 0;
+        arena->page_state = nullptr;
+        arena->page_slabs = nullptr;
+        arena->block_nodes = nullptr;
+    } else {
+        arena->start = start;
+        arena->size = size;
+        arena->page_state = page_state;
+        arena->page_slabs = page_slabs;
+        arena->block_nodes = block_nodes;
+    }
+
+    arena->page_size = huge ? huge_page_size : 4096;
+    arena->hugetlb = huge && free_hugetlb_pages() > 0;
+    arena->used = 0;
+    for (auto &list : arena->free_blocks) {
+        list = nullptr;
+    }
+}
+
+bool arena_contains(page_arena *arena, void *memory) {
+    return (uint8_t*)memory >= arena->start && (uint8_t*)memory < arena->start + arena->size;
+}
+
+void unlink_block(page_arena *arena, buddy_block *block, int order) {
+    if (block->previous) {
+        block->previous->next = block->next;
+    } else {
+        arena->free_blocks[order] = block->next;
+    }
+    if (block->next) {
+        block->next->previous = block->previous;
+    }
+}
+
+void link_block(page_arena *arena, void *memory, int order) {
+    auto block = (buddy_block*)memory;
+    block->previous = nullptr;
+    block->next = arena->free_blocks[order];
+    if (block->next) {
+        block->next->previous = block;
+    }
+    arena->free_blocks[order] = block;
+    arena->page_state[((uint8_t*)memory - arena->start) / 4096] = page_free | order;
+}
+
+/**
+ * Takes the next max_slab_order block of the range, nullptr when
+ * the range is over. Blocks of the MAP_HUGETLB pool are mapped one
+ * by one, so the pool is taken only as far as SLABs need it, and
+ * blocks go on with transparent huge pages once it is empty.
+ * arena->lock must be held
+ **/
+uint8_t *arena_grow(page_arena *arena) {
+    size_t block_size = (size_t)4096 << max_slab_order;
+    if (arena->used + block_size > arena->size) {
+        return nullptr;
+    }
+
+    auto block = arena->start + arena->used;
+    if (arena->hugetlb && mmap(block, block_size, PROT_READ | PROT_WRITE,
+                               MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_FIXED, -1, 0) == MAP_FAILED) {
+        // a failed MAP_FIXED may have unmapped the block already
+        arena->hugetlb = false;
+        if (mmap(block, block_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED,
+                 -1, 0) == MAP_FAILED) {
+            return nullptr;
+        }
+        madvise(block, block_size, MADV_HUGEPAGE);
+    }
+    arena->used += block_size;
+    return block;
+}
+
+void *arena_alloc(page_arena *arena, int order) {
+    std::lock_guard<std::mutex> guard(arena->lock);
+
+    int current = order;
+    while (current <= max_slab_order && !arena->free_blocks[current]) {
+        current += 1;
+    }
+
+    uint8_t *block;
+    if (current <= max_slab_order) {
+        block = (uint8_t*)arena->free_blocks[current];
+        unlink_block(arena, (buddy_block*)block, current);
+    } else if ((block = arena_grow(arena))) {
+        current = max_slab_order;
+    } else {
+        return nullptr;
+    }
+
+    // split, keeping the lower half and freeing the upper one
+    while (current > order) {
+        current -= 1;
+        link_block(arena, block + ((size_t)4096 << current), current);
+    }
+
+    arena->page_state[(block - arena->start) / 4096] = (uint8_t)order;
+    return block;
+}
+
+void arena_free(page_arena *arena, void *memory) {
+    std::lock_guard<std::mutex> guard(arena->lock);
+
+    auto block = (uint8_t*)memory;
+    auto page = (size_t)(block - arena->start) / 4096;
+    int order = arena->page_state[page];
+    arena->page_state[page] = 0;
+
+    while (order < max_slab_order) {
+        auto buddy_page = page ^ ((size_t)1 << order);
+        if ((arena->page_state[buddy_page] & ~page_purged) != (page_free | order)) {
+            break;
+        }
+
+        // only first pages of blocks may keep a state
+        unlink_block(arena, (buddy_block*)(arena->start + buddy_page * 4096), order);
+        arena->page_state[buddy_page] = 0;
+        page &= buddy_page;
+        order += 1;
+    }
+
+    link_block(arena, arena->start + page * 4096, order);
+}
+
+/**
+ * Gives the pages of free blocks back to the system with
+ * madvise(MADV_DONTNEED), the blocks stay in the free lists
+ * and are backed again on the next touch. The first page of
+ * a block holds its links, so blocks of one page are kept.
+ * Returns the count of bytes given back
+ **/
+size_t arena_purge(page_arena *arena) {
+    std::lock_guard<std::mutex> guard(arena->lock);
+
+    size_t purged = 0;
+    for (int order = 0; order <= max_slab_order; ++order) {
+        size_t block_size = (size_t)4096 << order;
+        if (block_size <= arena->page_size) {
+            continue;
+        }
+
+        for (auto block = arena->free_blocks[order]; block; block = block->next) {
+            auto &state = arena->page_state[((uint8_t*)block - arena->start) / 4096];
+            if (state & page_purged) {
+                continue;
+            }
+            if (!madvise((uint8_t*)block + arena->page_size, block_size - arena->page_size, MADV_DONTNEED)) {
+                state |= page_purged;
+                purged += block_size - arena->page_size;
+            }
+        }
+    }
+
+    return purged;
+}
+
+page_arena *default_arena() {
+    static page_arena *arena = [] {
+        auto arena = new page_arena();
+        arena_setup(arena, arena_size, false);
+        return arena;
+    }();
+    return arena;
+}
+
+std::atomic<page_arena*> huge_arena_instance;
+
+/**
+ * Arena of huge pages, reserved on the first use
+ * by a cache setup with SLAB_HUGEPAGE
+ **/
+page_arena *huge_arena() {
+    static page_arena *arena = [] {
+        auto arena = new page_arena();
+        arena_setup(arena, arena_size, true);
+        huge_arena_instance.store(arena, std::memory_order_release);
+        return arena;
+    }();
+    return arena;
+}
+
+// defined with cache_attach at the end
+page_arena *persistent_arena_of(void *memory);
+
+/**
+ * Arena the memory was allocated from, nullptr for foreign memory
+ **/
+page_arena *arena_of(void *memory) {
+    auto huge = huge_arena_instance.load(std::memory_order_acquire);
+    if (huge && arena_contains(huge, memory)) {
+        return huge;
+    }
+    auto arena = default_arena();
+    if (arena_contains(arena, memory)) {
+        return arena;
+    }
+    return persistent_arena_of(memory);
+}
+
+/**
+ * Size of an allocated block of the arena starting at `memory`
+ **/
+size_t arena_block_size(page_arena *arena, void *memory) {
+    return (size_t)4096 << arena->page_state[((uint8_t*)memory - arena->start) / 4096];
+}
+
+/**
+ * Points the page map entries of `size` bytes of SLAB memory
+ * at its slabStruct, nullptr clears them. Entries are written
+ * before objects of the SLAB are handed out and cleared after
+ * the last one came back, so lookups take no lock
+ **/
+void map_slab(void *memory, size_t size, slabStruct *slab) {
+    auto arena = arena_of(memory);
+    auto first = (size_t)((uint8_t*)memory - arena->start) / 4096;
+    for (size_t i = 0; i < size / 4096; ++i) {
+        arena->page_slabs[first + i] = slab;
+    }
+}
+
+/**
+ * The slabStruct of the SLAB holding `ptr` in two loads of
+ * the page map, like the pagemap of tcmalloc. Returns
+ * nullptr for memory not allocated to a SLAB
+ **/
+slabStruct *slab_lookup(void *ptr) {
+    auto arena = arena_of(ptr);
+    if (!arena) {
+        return nullptr;
+    }
+    return arena->page_slabs[(size_t)((uint8_t*)ptr - arena->start) / 4096];
+}
+
+/**
+ * This two functions you should use to allocate
+ * and free memory in this task. Internally
+ * they use buddy-allocator with page size of 4096 bytes
+ **/
+
+/**
+ * Allocates 4096 * 2^order byte chunk of memory,
+ * aligned on a 4096 * 2^order byte boundary. `order`
+ * must be in the interval [0; 10] (both borders
+ * inclusive), i.e. you can't allocate more than
+ * 4Mb at a time. Returns nullptr when the arena is over
+ **/
+void *alloc_slab(int order) {
+    return arena_alloc(default_arena(), order);
+}
+/**
+ * Free memory chunk previously allocated
+ * with the alloc_slab function
+ **/
+void free_slab(void *slab) {
+    if (auto arena = arena_of(slab)) {
+        arena_free(arena, slab);
+    }
+}
+
+std::mutex cache_registry_lock;
+std::condition_variable cache_registry_unpinned; /* signalled when reclaim_pins of a cache drops to 0 */
+struct cache *cache_registry; /* every set up cache, linked by registry_next */
+
+void register_cache(struct cache *cache) {
+    std::lock_guard<std::mutex> guard(cache_registry_lock);
+    cache->registry_previous = nullptr;
+    cache->registry_next = cache_registry;
+    if (cache_registry) {
+        cache_registry->registry_previous = cache;
+    }
+    cache_registry = cache;
+    cache->registered = true;
+    cache->reclaim_pins = 0;
+}
+
+/**
+ * Unlinks the cache from the registry and waits for the
+ * reclaimer thread to leave it
+ **/
+void unregister_cache(struct cache *cache) {
+    std::unique_lock<std::mutex> lock(cache_registry_lock);
+    if (!cache->registered) {
+        return;
+    }
+    if (cache->registry_previous) {
+        cache->registry_previous->registry_next = cache->registry_next;
+    } else {
+        cache_registry = cache->registry_next;
+    }
+    if (cache->registry_next) {
+        cache->registry_next->registry_previous = cache->registry_previous;
+    }
+    cache->registered = false;
+    cache_registry_unpinned.wait(lock, [cache] { return cache->reclaim_pins == 0; });
+}
+
+/* SLABs in the partially_slabs lists below this one are evacuated by cache_defrag */
+const unsigned defrag_bin_count = 2;
+
+/* free SLABs per NUMA node cache_shrink_budget keeps by default */
+const size_t default_free_slabs_kept = 2;
+
+/* objects of at least this size may keep their slabStruct off the SLAB */
+const size_t off_slab_threshold = 4096 / 8;
+
+
+
+std::mutex thread_index_lock;
+bool thread_index_used[max_magazine_threads];
+
+/**
+ * Index of a live thread in cache->magazines. Indexes of
+ * finished threads are reused together with the magazines
+ * they left behind
+ **/
+struct thread_index {
+    int index;
+
+    thread_index() : index(-1) {
+        std::lock_guard<std::mutex> guard(thread_index_lock);
+        for (size_t i = 0; i < max_magazine_threads; ++i) {
+            if (!thread_index_used[i]) {
+                thread_index_used[i] = true;
+                index = (int)i;
+                break;
+            }
+        }
+    }
+
+    ~thread_index() {
+        if (index >= 0) {
+            std::lock_guard<std::mutex> guard(thread_index_lock);
+            thread_index_used[index] = false;
+        }
+    }
+};
+
+int current_thread_index() {
+    thread_local thread_index current;
+    return current.index;
+}
+
+/**
+ * Count of NUMA nodes of the machine from
+ * /sys/devices/system/node/possible, like "0-3"
+ **/
+int numa_node_count() {
+    static int count = [] {
+        int last = 0;
+        if (FILE *possible = fopen("/sys/devices/system/node/possible", "r")) {
+            int first;
+            if (fscanf(possible, "%d-%d", &first, &last) < 1) {
+                last = 0;
+            } else if (last < first) {
+                last = first;
+            }
+            fclose(possible);
+        }
+        return std::max(1, std::min(last + 1, max_numa_nodes));
+    }();
+    return count;
+}
+
+int current_numa_node() {
+    if (numa_node_count() == 1) {
+        return 0;
+    }
+
+    unsigned cpu;
+    unsigned node;
+    if (getcpu(&cpu, &node) != 0) {
+        return 0;
+    }
+    return (int)(node % numa_node_count());
+}
+
+/**
+ * Prefers the node for the pages not touched yet of the
+ * max_slab_order block of the arena holding the memory, the
+ * touched ones stay where they are. A block is bound again only
+ * for another node: an mbind of every SLAB would cost a syscall
+ * each and split the arena mapping into as many VMAs
+ **/
+void bind_to_node(page_arena *arena, void *memory, int node) {
+    if (numa_node_count() == 1 || !arena->block_nodes) {
+        return;
+    }
+
+    size_t block_size = (size_t)4096 << max_slab_order;
+    size_t block = (size_t)((uint8_t*)memory - arena->start) / block_size;
+    if (arena->block_nodes[block].exchange((uint8_t)(node + 1), std::memory_order_relaxed) == node + 1) {
+        return;
+    }
+
+    unsigned long nodemask = 1ul << node;
+    syscall(SYS_mbind, arena->start + block * block_size, block_size, MPOL_PREFERRED, &nodemask,
+            sizeof(nodemask) * 8, 0);
+}
+
+/**
+ * Picks the smallest SLAB order in [0; 10] leaving no more
+ * than max_slab_waste percents of the SLAB unused when every
+ * SLAB starts with `header` bytes of metadata. If there is
+ * no such order the one with the least waste is used.
+ * Returns the order, `objects` receives objects per SLAB
+ * and `waste` the unused bytes of every SLAB (header included),
+ * order -1 means the object doesn't fit even the largest SLAB
+ **/
+int calculate_slab_order(size_t object_size, size_t header, size_t *objects, size_t *waste) {
+    int best_order = -1;
+
+    for (int order = 0; order <= 10; ++order) {
+        size_t slab_size = (size_t)4096 << order;
+        if (slab_size < header + object_size) {
+            continue;
+        }
+
+        size_t count = (slab_size - header) / object_size;
+        size_t unused = slab_size - count * object_size;
+
+        // compare unused shares of SLABs of different orders
+        if (best_order < 0 || unused << best_order < *waste << order) {
+            best_order = order;
+            *objects = count;
+            *waste = unused;
+        }
+
+        if (unused * 100 <= slab_size * max_slab_waste) {
+            return order;
+        }
+    }
+
+    return best_order;
+}
+
+/**
+ * Free objects link to the next ones at free_offset, past the
+ * object itself in caches with a constructor to keep it intact
+ **/
+#ifdef SLAB_FREELIST_HARDENED
+/**
+ * Free pointers are stored mixed with a secret of the cache and
+ * their own address, like CONFIG_SLAB_FREELIST_HARDENED of Linux,
+ * so an overflow can't plant a chosen pointer in a free list
+ **/
+uintptr_t free_pointer_mask(struct cache *cache, void *slot) {
+    return cache->freelist_random ^ __builtin_bswap64((uintptr_t)slot);
+}
+#endif
+
+void *get_free_pointer(struct cache *cache, void *object) {
+    auto slot = (uint8_t*)object + cache->free_offset;
+#ifdef SLAB_FREELIST_HARDENED
+    return (void*)(*(uintptr_t*)slot ^ free_pointer_mask(cache, slot));
+#else
+    return *(void**)slot;
+#endif
+}
+
+void set_free_pointer(struct cache *cache, void *object, void *next) {
+    auto slot = (uint8_t*)object + cache->free_offset;
+#ifdef SLAB_FREELIST_HARDENED
+    *(uintptr_t*)slot = (uintptr_t)next ^ free_pointer_mask(cache, slot);
+#else
+    *(void**)slot = next;
+#endif
+}
+
+void report_corruption(struct cache *cache, const char *error, void *object) {
+    cache->corruptions.fetch_add(1, std::memory_order_relaxed);
+    fprintf(stderr, "slab: %s %p in cache %p\n", error, object, (void*)cache);
+}
+
+/**
+ * Whether `object` is the start of an object of the SLAB
+ **/
+bool slab_holds(struct cache *cache, slabStruct *slab, void *object) {
+    auto offset = (size_t)((uint8_t*)object - slab->objects);
+    return (uint8_t*)object >= slab->objects && offset % cache->object_size == 0 &&
+           offset / cache->object_size < cache->slab_objects;
+}
+
+/* redzone bytes of objects in a SLAB and held by the application, the values of Linux SLUB */
+const uint8_t red_zone_inactive = 0xbb;
+const uint8_t red_zone_active = 0xcc;
+
+/* SLAB_POISON fills free objects with it and ends them with poison_end */
+const uint8_t poison_free = 0x6b;
+const uint8_t poison_end = 0xa5;
+
+/* the last byte of allocated objects of SLAB_POISON caches without a redzone */
+const uint8_t poison_in_use = 0x5a;
+
+enum red_zone_state {
+    red_zone_free,
+    red_zone_allocated,
+    red_zone_damaged,
+};
+
+/**
+ * State of the redzone of an object: its last 8 bytes are an
+ * aligned word compared at once, the bytes before it one by one
+ **/
+red_zone_state read_red_zone(struct cache *cache, void *object) {
+    uint64_t word;
+    memcpy(&word, (uint8_t*)object + cache->red_zone_offset, sizeof(word));
+
+    uint8_t pattern = (uint8_t)word;
+    if ((pattern != red_zone_inactive && pattern != red_zone_active) || word != pattern * 0x0101010101010101ull) {
+        return red_zone_damaged;
+    }
+    for (size_t i = cache->debug_size; i < cache->red_zone_offset; ++i) {
+        if (((uint8_t*)object)[i] != pattern) {
+            return red_zone_damaged;
+        }
+    }
+    return pattern == red_zone_active ? red_zone_allocated : red_zone_free;
+}
+
+void write_red_zone(struct cache *cache, void *object, uint8_t pattern) {
+    memset((uint8_t*)object + cache->debug_size, pattern, cache->red_zone_offset + sizeof(uint64_t) - cache->debug_size);
+}
+
+bool poison_intact(struct cache *cache, void *object) {
+    auto bytes = (uint8_t*)object;
+    for (size_t i = 0; i + 1 < cache->debug_size; ++i) {
+        if (bytes[i] != poison_free) {
+            return false;
+        }
+    }
+    return bytes[cache->debug_size - 1] == poison_end;
+}
+
+/**
+ * Marks an object of a debug cache free: inactive redzone
+ * and poison, whichever the cache has
+ **/
+void debug_free_object(struct cache *cache, void *object) {
+    if (cache->flags & SLAB_RED_ZONE) {
+        write_red_zone(cache, object, red_zone_inactive);
+    }
+    if (cache->flags & SLAB_POISON) {
+        memset(object, poison_free, cache->debug_size - 1);
+        ((uint8_t*)object)[cache->debug_size - 1] = poison_end;
+    }
+}
+
+/**
+ * Marks an object of a debug cache allocated: an active redzone,
+ * without one the poison is broken, so the free of an object the
+ * application never wrote isn't taken for a double free
+ **/
+void debug_alloc_object(struct cache *cache, void *object) {
+    if (cache->flags & SLAB_RED_ZONE) {
+        write_red_zone(cache, object, red_zone_active);
+    } else if (cache->flags & SLAB_POISON) {
+        ((uint8_t*)object)[cache->debug_size - 1] = poison_in_use;
+    }
+}
+
+/**
+ * Checks objects a debug cache hands out were not written
+ * while they were free and marks them allocated.
+ * Damaged objects are reported and handed out anyway
+ **/
+void debug_allocs(struct cache *cache, void **objects, size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+        if (cache->flags & SLAB_RED_ZONE) {
+            auto state = read_red_zone(cache, objects[i]);
+            if (state == red_zone_allocated) {
+                report_corruption(cache, "second allocation of", objects[i]);
+            } else if (state == red_zone_damaged) {
+                report_corruption(cache, "redzone overwritten after", objects[i]);
+            }
+        }
+        if ((cache->flags & SLAB_POISON) && !poison_intact(cache, objects[i])) {
+            report_corruption(cache, "write after free to", objects[i]);
+        }
+        debug_alloc_object(cache, objects[i]);
+    }
+}
+
+/**
+ * Checks objects given back to a debug cache: the page map
+ * tells if they are objects of its SLABs, the redzone, or
+ * the poison without one, if they are allocated. Foreign
+ * pointers and double frees are reported and dropped, the
+ * rest is compacted at the start of `objects` and marked free.
+ * Returns the count of objects left to free
+ **/
+size_t check_frees(struct cache *cache, void **objects, size_t count) {
+    size_t kept = 0;
+
+    for (size_t i = 0; i < count; ++i) {
+        void *object = objects[i];
+        auto slab = slab_lookup(object);
+        if (!slab || slab->cache != cache || !slab_holds(cache, slab, object)) {
+            report_corruption(cache, "free of a foreign pointer", object);
+            continue;
+        }
+
+        if (cache->flags & SLAB_RED_ZONE) {
+            auto state = read_red_zone(cache, object);
+            if (state == red_zone_free) {
+                report_corruption(cache, "double free of", object);
+                continue;
+            }
+            if (state == red_zone_damaged) {
+                report_corruption(cache, "redzone overwritten after", object);
+            }
+        } else if (poison_intact(cache, object)) {
+            // allocations break the poison, it is intact only since the last free
+            report_corruption(cache, "double free of", object);
+            continue;
+        }
+
+        debug_free_object(cache, object);
+        objects[kept++] = object;
+    }
+    return kept;
+}
+
+/**
+ * Threads the free object list through every object
+ * of a freshly allocated SLAB, so objects are handed
+ * out in address order. Bitmap SLABs get a bit set
+ * for every object instead
+ **/
+void init_free_list(struct cache *cache, slabStruct *slab) {
+    if (cache->bitmap_words) {
+        for (size_t i = 0; i < cache->bitmap_words; ++i) {
+            // the bitmap may have more words than objects need
+            size_t bits = i * 64 < cache->slab_objects ? std::min<size_t>(64, cache->slab_objects - i * 64) : 0;
+            slab->bitmap[i] = bits == 64 ? ~(uint64_t)0 : ((uint64_t)1 << bits) - 1;
+        }
+        slab->bitmap_hint = 0;
+        slab->free_object = nullptr;
+        return;
+    }
+
+    auto objects = slab->objects;
+    void *next = nullptr;
+
+    for (size_t i = cache->slab_objects; i > 0; --i) {
+        void *object = objects + cache->object_size * (i - 1);
+        set_free_pointer(cache, object, next);
+        next = object;
+    }
+
+    slab->free_object = next;
+}
+
+/**
+ * Takes up to `count` free objects of a SLAB, a bitmap SLAB
+ * hands out the free slots of one 64-bit word at a time with
+ * ctz. Returns the count of taken objects
+ **/
+size_t pop_free_objects(struct cache *cache, slabStruct *slab, void **objects, size_t count) {
+    size_t taken = 0;
+
+    if (!cache->bitmap_words) {
+        while (taken < count && slab->free_object) {
+            objects[taken++] = slab->free_object;
+            slab->free_object = get_free_pointer(cache, slab->free_object);
+#ifdef SLAB_FREELIST_HARDENED
+            // the rest of a damaged list is lost, the SLAB counts its objects as used
+            if (slab->free_object && !slab_holds(cache, slab, slab->free_object)) {
+                report_corruption(cache, "free list damaged after", objects[taken - 1]);
+                slab->free_object = nullptr;
+                slab->refcnt = (uint32_t)(cache->slab_objects - taken);
+            }
+#endif
+        }
+        // the next pop reads the free pointer of the new head
+        if (slab->free_object) {
+            __builtin_prefetch((uint8_t*)slab->free_object + cache->free_offset);
+        }
+        slab->refcnt += taken;
+        return taken;
+    }
+
+    while (taken < count && slab->bitmap_hint < cache->bitmap_words) {
+        uint64_t word = slab->bitmap[slab->bitmap_hint];
+        while (taken < count && word) {
+            size_t index = slab->bitmap_hint * 64 + __builtin_ctzll(word);
+            objects[taken++] = slab->objects + index * cache->object_size;
+            word &= word - 1;
+        }
+        slab->bitmap[slab->bitmap_hint] = word;
+        if (!word) {
+            slab->bitmap_hint += 1;
+        }
+    }
+    slab->refcnt += taken;
+    return taken;
+}
+
+void *pop_free_object(struct cache *cache, slabStruct *slab) {
+    void *object;
+    pop_free_objects(cache, slab, &object, 1);
+    return object;
+}
+
+/**
+ * Bytes from the SLAB start to the first object of the
+ * first colour, the slabStruct rounded up to the alignment
+ **/
+size_t slab_header_size(struct cache *cache) {
+    size_t header = sizeof(slabStruct) + cache->bitmap_words * sizeof(uint64_t);
+    return cache->off_slab ? 0 : (header + cache->align - 1) & ~(cache->align - 1);
+}
+
+void *calculate_slab_memory(struct cache *cache, void *allocation) {
+    auto mask = ~(((uintptr_t)1 << (cache->slab_order + 12)) - 1);
+    return (void*)((uintptr_t)allocation & mask);
+}
+
+slabStruct* calculate_slab_start(struct cache *cache, void *allocation) {
+    auto memory = calculate_slab_memory(cache, allocation);
+    if (cache->off_slab) {
+        return slab_lookup(memory);
+    }
+    return (slabStruct*)memory;
+}
+
+/**
+ * Prepares the memory of a SLAB taken into use for its first
+ * allocation: objects are constructed and the free list built
+ **/
+void init_slab(struct cache *cache, slabStruct *slab) {
+    slab->previous = nullptr;
+    slab->next = nullptr;
+    slab->refcnt = 0;
+    slab->bin = 0;
+    slab->isolated = false;
+    slab->remote_free.store(nullptr, std::memory_order_relaxed);
+    slab->remote_next = nullptr;
+    slab->stack_next.store(nullptr, std::memory_order_relaxed);
+
+    // objects stay constructed while they are free, so it happens once per SLAB
+    if (cache->ctor) {
+        for (size_t i = 0; i < cache->slab_objects; ++i) {
+            cache->ctor(slab->objects + cache->object_size * i);
+        }
+    }
+    if (cache->debug_size) {
+        for (size_t i = 0; i < cache->slab_objects; ++i) {
+            debug_free_object(cache, slab->objects + cache->object_size * i);
+        }
+    }
+    init_free_list(cache, slab);
+}
+
+/**
+ * Takes the SLAB which went idle the latest on `node` back into
+ * use, no syscall needed: pages MADV_FREE gave back are backed
+ * again on the first touch. nullptr if the node has no idle SLABs
+ **/
+slabStruct *take_idle_slab(struct cache *cache, int node) {
+    auto &idle = cache->nodes[node];
+    slabStruct *slab = idle.idle_slab;
+    if (!slab) {
+        return nullptr;
+    }
+
+    idle.idle_slab = slab->next;
+    if (slab->next) {
+        slab->next->previous = nullptr;
+    }
+    idle.idle_count -= 1;
+
+    init_slab(cache, slab);
+    map_slab(calculate_slab_memory(cache, slab->objects), (size_t)4096 << cache->slab_order, slab);
+    return slab;
+}
+
+/**
+ * Allocates a SLAB with its slabStruct and free object list,
+ * an idle one of the node first. Returns nullptr if the memory is over
+ **/
+slabStruct *create_slab(struct cache *cache, int node) {
+    if (auto slab = take_idle_slab(cache, node)) {
+        return slab;
+    }
+
+    auto memory = (uint8_t*)arena_alloc(cache->arena, cache->slab_order);
+    // a MAP_HUGETLB pool can be over, regular pages do too, a file keeps only SLABs of its arena
+    if (!memory && cache->arena != default_arena() && !(cache->flags & SLAB_PERSISTENT)) {
+        memory = (uint8_t*)alloc_slab(cache->slab_order);
+    }
+    if (!memory) {
+        return nullptr;
+    }
+    bind_to_node(arena_of(memory), memory, node);
+
+    // colour the SLAB: shift its objects by the next count of cache lines the unused tail allows
+    size_t header = slab_header_size(cache);
+    size_t colour_step = std::max(cache_line_size, cache->align);
+    size_t unused = ((size_t)4096 << cache->slab_order) - header - cache->slab_objects * cache->object_size;
+    if (cache->colour_next * colour_step > unused) {
+        cache->colour_next = 0;
+    }
+    size_t colour = cache->colour_next++ * colour_step;
+
+    slabStruct *slab;
+    if (cache->off_slab) {
+        slab = new slabStruct();
+        slab->objects = memory + colour;
+    } else {
+        slab = (slabStruct*)memory;
+        slab->objects = memory + header + colour;
+    }
+
+    slab->cache = cache;
+    slab->node = node;
+    // bitmap caches keep the slabStruct in the SLAB, the bitmap follows it
+    slab->bitmap = cache->bitmap_words ? (uint64_t*)(slab + 1) : nullptr;
+
+    init_slab(cache, slab);
+    map_slab(memory, (size_t)4096 << cache->slab_order, slab);
+
+#ifdef SLAB_STATS
+    cache->slab_allocs += 1;
+    cache->peak_slabs = std::max<size_t>(cache->peak_slabs, cache->slab_allocs - cache->slab_frees);
+#endif
+
+    return slab;
+}
+
+/**
+ * Destructs the objects of a free SLAB leaving use, the
+ * page map and the cursor of its node forget it
+ **/
+void retire_slab(struct cache *cache, slabStruct *slab) {
+    if (cache->dtor) {
+        for (size_t i = 0; i < cache->slab_objects; ++i) {
+            cache->dtor(slab->objects + cache->object_size * i);
+        }
+    }
+
+    auto &cursor = cache->nodes[slab->node].cursor;
+    if (cursor == slab) {
+        cursor = nullptr;
+    }
+
+    map_slab(calculate_slab_memory(cache, slab->objects), (size_t)4096 << cache->slab_order, nullptr);
+}
+
+/**
+ * Gives the memory of a retired SLAB back with free_slab
+ **/
+void free_slab_memory(struct cache *cache, slabStruct *slab) {
+#ifdef SLAB_STATS
+    cache->slab_frees += 1;
+#endif
+
+    auto memory = calculate_slab_memory(cache, slab->objects);
+    if (cache->off_slab) {
+        delete slab;
+    }
+    free_slab(memory);
+}
+
+void destroy_slab(struct cache *cache, slabStruct *slab) {
+    retire_slab(cache, slab);
+    free_slab_memory(cache, slab);
+}
+
+uint64_t idle_clock_ms() {
+    return (uint64_t)std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * Releases a free SLAB a shrink took off the lists: with an
+ * idle timeout it goes to the idle list of its node, its pages
+ * past the first one given back with MADV_FREE, MADV_REMOVE
+ * for a file of cache_attach, so the next create_slab reuses
+ * it without alloc_slab. Without a timeout it goes back to
+ * the arena at once. cache->lock must be held
+ **/
+void shrink_slab(struct cache *cache, slabStruct *slab) {
+    if (!cache->idle_timeout) {
+        destroy_slab(cache, slab);
+        return;
+    }
+
+    retire_slab(cache, slab);
+
+    // the free list goes with the pages, take_idle_slab builds it again. The first page
+    // stays even off-slab: SLABs of one page cost no madvise call, like in arena_purge
+    auto memory = (uint8_t*)calculate_slab_memory(cache, slab->objects);
+    size_t size = (size_t)4096 << cache->slab_order;
+    size_t kept = arena_of(memory)->page_size;
+    if (size > kept && (cache->flags & SLAB_PERSISTENT)) {
+        // MADV_FREE takes only private anonymous memory, pages of a file go with a hole punched in it
+        madvise(memory + kept, size - kept, MADV_REMOVE);
+    } else if (size > kept) {
+#ifdef MADV_FREE
+        madvise(memory + kept, size - kept, MADV_FREE);
+#else
+        madvise(memory + kept, size - kept, MADV_DONTNEED);
+#endif
+    }
+
+    auto &node = cache->nodes[slab->node];
+    slab->idle_since = idle_clock_ms();
+    slab->previous = nullptr;
+    slab->next = node.idle_slab;
+    if (slab->next) {
+        slab->next->previous = slab;
+    }
+    node.idle_slab = slab;
+    node.idle_count += 1;
+}
+
+/**
+ * Gives up to `max_slabs` SLABs idle for `timeout` milliseconds
+ * or longer back to the arena, the longest idle ones first.
+ * cache->lock must be held. Returns the count of freed SLABs
+ **/
+size_t expire_idle_slabs(struct cache *cache, size_t max_slabs, uint64_t timeout) {
+    size_t released = 0;
+    uint64_t now = idle_clock_ms();
+
+    for (auto &node : cache->nodes) {
+        slabStruct *slab = node.idle_slab;
+        while (slab && slab->next) {
+            slab = slab->next;
+        }
+
+        while (slab && released < max_slabs && now - slab->idle_since >= timeout) {
+            auto previous = slab->previous;
+            if (previous) {
+                previous->next = nullptr;
+            } else {
+                node.idle_slab = nullptr;
+            }
+            node.idle_count -= 1;
+            free_slab_memory(cache, slab);
+            slab = previous;
+            released += 1;
+        }
+    }
+
+    return released;
+}
+
+void free_list(struct cache *cache, slabStruct *list) {
+    slabStruct* current = list;
+
+    while (current) {
+        slabStruct* next = current->next;
+        destroy_slab(cache, current);
+        current = next;
+    }
+}
+
+void unlink_slab(slabStruct **list, slabStruct *slab) {
+    if (auto previous = slab->previous) {
+        previous->next = slab->next;
+    } else {
+        *list = slab->next;
+    }
+
+    if (auto next = slab->next) {
+        next->previous = slab->previous;
+    }
+
+    slab->previous = nullptr;
+    slab->next = nullptr;
+}
+
+void link_slab(slabStruct **list, slabStruct *slab) {
+    slab->next = *list;
+    slab->previous = nullptr;
+    if (*list) {
+        (*list)->previous = slab;
+    }
+    *list = slab;
+}
+
+void remove_from_complete_list(cache_node *node, slabStruct *slab) {
+    unlink_slab(&node->complete_slab, slab);
+    node->complete_count -= 1;
+    if (node->complete_count < node->complete_low) {
+        node->complete_low = node->complete_count;
+    }
+}
+
+void remove_from_partially_list(cache_node *node, slabStruct *slab) {
+    unlink_slab(&node->partially_slabs[slab->bin], slab);
+    node->partially_count -= 1;
+    if (!node->partially_slabs[slab->bin]) {
+        node->partially_mask &= ~(1u << slab->bin);
+    }
+}
+
+void remove_from_empty_list(cache_node *node, slabStruct *slab) {
+    unlink_slab(&node->empty_slab, slab);
+    node->empty_count -= 1;
+}
+
+void insert_in_complete_list(cache_node *node, slabStruct *slab) {
+    link_slab(&node->complete_slab, slab);
+    node->complete_count += 1;
+}
+
+/**
+ * Links a partially occupied SLAB in the list of its occupancy,
+ * the share of used objects rounded down to 1/partial_bin_count
+ **/
+void insert_in_partially_list(struct cache *cache, cache_node *node, slabStruct *slab) {
+    slab->bin = (unsigned)(slab->refcnt * partial_bin_count / cache->slab_objects);
+    link_slab(&node->partially_slabs[slab->bin], slab);
+    node->partially_count += 1;
+    node->partially_mask |= 1u << slab->bin;
+}
+
+/**
+ * Moves a SLAB which stays partially occupied
+ * to the list of its new occupancy
+ **/
+void update_partially_list(struct cache *cache, cache_node *node, slabStruct *slab) {
+    if (slab->refcnt * partial_bin_count / cache->slab_objects != slab->bin) {
+        remove_from_partially_list(node, slab);
+        insert_in_partially_list(cache, node, slab);
+    }
+}
+
+/**
+ * The fullest partially occupied SLAB of a node, nullptr if none
+ **/
+slabStruct *fullest_partially_slab(cache_node *node) {
+    if (!node->partially_mask) {
+        return nullptr;
+    }
+    return node->partially_slabs[31 - __builtin_clz(node->partially_mask)];
+}
+
+void insert_in_empty_list(cache_node *node, slabStruct *slab) {
+    link_slab(&node->empty_slab, slab);
+    node->empty_count += 1;
+}
+
+/**
+ * Node having SLABs with free objects, partially occupied
+ * ones preferred, -1 if there are none. cache->lock must be held
+ **/
+int find_node_with_objects(struct cache *cache) {
+    int complete = -1;
+
+    for (int i = 0; i < numa_node_count(); ++i) {
+        if (cache->nodes[i].partially_mask) {
+            return i;
+        }
+        if (complete < 0 && cache->nodes[i].complete_slab) {
+            complete = i;
+        }
+    }
+
+    return complete;
+}
+
+/**
+ * Moves a SLAB objects were taken from to the list of its new
+ * occupancy, `was_partial` tells if it is on a partial list.
+ * cache->lock must be held
+ **/
+void relink_allocated_slab(struct cache *cache, cache_node *node, slabStruct *slab, bool was_partial)
+{
+    if (slab->refcnt == cache->slab_objects) {
+        if (was_partial) {
+            remove_from_partially_list(node, slab);
+        }
+        insert_in_empty_list(node, slab);
+    } else if (!was_partial) {
+        insert_in_partially_list(cache, node, slab);
+    } else {
+        update_partially_list(cache, node, slab);
+    }
+}
+
+/**
+ * Takes up to `count` objects from the SLAB lists of NUMA
+ * node `current`, from other nodes only if no memory is
+ * left for a new SLAB. The free list of one SLAB is emptied
+ * in a single pass before it moves to its new list.
+ * cache->lock must be held, `thread` is current_thread_index()
+ * taken before it: the first call takes thread_index_lock.
+ * Returns the count of taken objects
+ **/
+size_t slab_alloc_node_objects(struct cache *cache, void **objects, size_t count, int thread, int current)
+{
+    size_t allocated = 0;
+
+    while (allocated < count) {
+        cache_node *node = &cache->nodes[current];
+        slabStruct* current_slab = node->cursor;
+        bool was_partial = true;
+
+        // the SLAB of the previous allocation is hot, like cpu_slab of SLUB, while it stays partial
+        if (!current_slab || current_slab->isolated || current_slab->refcnt == 0 ||
+                current_slab->refcnt == cache->slab_objects) {
+            // the fullest SLAB first, sparse ones get a chance to become free
+            current_slab = fullest_partially_slab(node);
+            was_partial = current_slab != nullptr;
+        }
+
+        if (!current_slab) {
+            if ((current_slab = node->complete_slab)) {
+                remove_from_complete_list(node, current_slab);
+            } else if (!cache->slab_objects) {
+                break;
+            } else if (!(current_slab = create_slab(cache, current))) {
+                // no memory for a new SLAB, objects of other nodes are better than none
+                if ((current = find_node_with_objects(cache)) < 0) {
+                    break;
+                }
+                continue;
+            }
+            current_slab->owner.store(thread, std::memory_order_relaxed);
+        }
+
+        allocated += pop_free_objects(cache, current_slab, objects + allocated, count - allocated);
+        relink_allocated_slab(cache, node, current_slab, was_partial);
+
+        node->cursor = current_slab;
+        if (current_slab->refcnt == cache->slab_objects) {
+            // the next allocation goes to the lists, their SLAB header is loaded meanwhile
+            if (auto next = fullest_partially_slab(node)) {
+                __builtin_prefetch(next);
+            }
+        }
+    }
+
+    return allocated;
+}
+
+/**
+ * Takes up to `count` objects from the SLAB lists of the
+ * current NUMA node, like slab_alloc_node_objects
+ **/
+size_t slab_alloc_objects(struct cache *cache, void **objects, size_t count, int thread)
+{
+    return slab_alloc_node_objects(cache, objects, count, thread, current_numa_node());
+}
+
+/**
+ * Takes one object from the SLAB lists, like slab_alloc_objects
+ **/
+void *slab_alloc_object(struct cache *cache, int thread)
+{
+    void *object;
+    return slab_alloc_objects(cache, &object, 1, thread) ? object : nullptr;
+}
+
+/**
+ * Moves a SLAB which got `count` objects back to the list
+ * of its new occupancy. cache->lock must be held
+ **/
+void relink_freed_slab(struct cache *cache, slabStruct *slab, size_t count)
+{
+    auto node = &cache->nodes[slab->node];
+    bool was_full = slab->refcnt + count == cache->slab_objects;
+
+    // cache_defrag links the SLAB back once it is done
+    if (slab->isolated) {
+        return;
+    }
+
+    // a full SLAB has free capacity again, the partial list must see it
+    if (was_full) {
+        remove_from_empty_list(node, slab);
+        if (slab->refcnt == 0) {
+            insert_in_complete_list(node, slab);
+        } else {
+            insert_in_partially_list(cache, node, slab);
+        }
+    } else if (slab->refcnt == 0) {
+        remove_from_partially_list(node, slab);
+        insert_in_complete_list(node, slab);
+    } else {
+        update_partially_list(cache, node, slab);
+    }
+}
+
+/**
+ * Returns `count` objects of one SLAB, linked from `head`
+ * to `tail`, to its free list at once. cache->lock must be held
+ **/
+void slab_free_chain(struct cache *cache, slabStruct *slab, void *head, void *tail, size_t count)
+{
+    set_free_pointer(cache, tail, slab->free_object);
+    slab->free_object = head;
+    slab->refcnt -= count;
+    relink_freed_slab(cache, slab, count);
+}
+
+/**
+ * Sets the bit of a slot of a bitmap SLAB, a set bit is a
+ * double free and left alone. Returns whether the slot was freed
+ **/
+bool free_slot(struct cache *cache, slabStruct *slab, size_t index) {
+    uint64_t bit = (uint64_t)1 << (index % 64);
+    if (slab->bitmap[index / 64] & bit) {
+        report_corruption(cache, "double free of", slab->objects + index * cache->object_size);
+        return false;
+    }
+    slab->bitmap[index / 64] |= bit;
+    return true;
+}
+
+/**
+ * Sets the bits of `count` slots of a bitmap SLAB from
+ * `first` on. cache->lock must be held
+ **/
+void slab_free_slots(struct cache *cache, slabStruct *slab, size_t first, size_t count)
+{
+    size_t freed = 0;
+    for (size_t i = first; i < first + count; ++i) {
+        freed += free_slot(cache, slab, i);
+    }
+    slab->bitmap_hint = std::min(slab->bitmap_hint, first / 64);
+    slab->refcnt -= freed;
+    if (freed) {
+        relink_freed_slab(cache, slab, freed);
+    }
+}
+
+size_t slot_index(struct cache *cache, slabStruct *slab, void *object) {
+    return (size_t)((uint8_t*)object - slab->objects) / cache->object_size;
+}
+
+/**
+ * Returns `count` objects of one SLAB to it with a single
+ * list move, like detached free lists of Linux
+ * kmem_cache_free_bulk. cache->lock must be held
+ **/
+void slab_free_run(struct cache *cache, slabStruct *slab, void **objects, size_t count)
+{
+    if (!cache->bitmap_words) {
+        for (size_t i = 1; i < count; ++i) {
+            set_free_pointer(cache, objects[i], objects[i - 1]);
+        }
+        slab_free_chain(cache, slab, objects[count - 1], objects[0], count);
+        return;
+    }
+
+    size_t freed = 0;
+    for (size_t i = 0; i < count; ++i) {
+        size_t index = slot_index(cache, slab, objects[i]);
+        freed += free_slot(cache, slab, index);
+        slab->bitmap_hint = std::min(slab->bitmap_hint, index / 64);
+    }
+    slab->refcnt -= freed;
+    if (freed) {
+        relink_freed_slab(cache, slab, freed);
+    }
+}
+
+/**
+ * Returns objects to their SLABs, a run of objects of one SLAB
+ * is freed at once. cache->lock must be held
+ **/
+void slab_free_objects(struct cache *cache, void **objects, size_t count)
+{
+    size_t i = 0;
+
+    while (i < count) {
+        auto memory = calculate_slab_memory(cache, objects[i]);
+        size_t run = 1;
+
+        while (i + run < count && calculate_slab_memory(cache, objects[i + run]) == memory) {
+            run += 1;
+        }
+
+        slab_free_run(cache, calculate_slab_start(cache, objects[i]), objects + i, run);
+        i += run;
+    }
+}
+
+/**
+ * Returns one object to its SLAB, cache->lock must be held
+ **/
+void slab_free_object(struct cache *cache, void *ptr)
+{
+    slab_free_run(cache, calculate_slab_start(cache, ptr), &ptr, 1);
+}
+
+/**
+ * Frees an object of a SLAB owned by another thread without
+ * taking cache->lock, like mimalloc's thread free lists. The
+ * object goes to the SLAB's remote_free list, a SLAB whose list
+ * was empty is queued to cache->remote_slabs for collection
+ **/
+void remote_free_object(struct cache *cache, slabStruct *slab, void *ptr) {
+    // acq_rel orders writes of remote_next after the collector has read it
+    void *head = slab->remote_free.load(std::memory_order_relaxed);
+    do {
+        set_free_pointer(cache, ptr, head);
+    } while (!slab->remote_free.compare_exchange_weak(head, ptr, std::memory_order_acq_rel, std::memory_order_relaxed));
+
+    if (!head) {
+        slabStruct *slabs = cache->remote_slabs.load(std::memory_order_relaxed);
+        do {
+            slab->remote_next = slabs;
+        } while (!cache->remote_slabs.compare_exchange_weak(slabs, slab, std::memory_order_release, std::memory_order_relaxed));
+    }
+}
+
+/**
+ * Returns objects freed by remote_free_object to their SLABs,
+ * cache->lock must be held
+ **/
+void collect_remote_frees(struct cache *cache) {
+    if (!cache->remote_slabs.load(std::memory_order_relaxed)) {
+        return;
+    }
+
+    auto slab = cache->remote_slabs.exchange(nullptr, std::memory_order_acquire);
+    while (slab) {
+        // once remote_free is taken the SLAB may be queued again, and remote_next reused
+        auto next = slab->remote_next;
+        void *object = slab->remote_free.exchange(nullptr, std::memory_order_acq_rel);
+
+        while (object) {
+            void *next_object = get_free_pointer(cache, object);
+            slab_free_object(cache, object);
+            object = next_object;
+        }
+
+        slab = next;
+    }
+}
+
+/* remote_free of a full SLAB of a SLAB_CONCURRENT cache no thread allocates from */
+void *const slab_detached = (void*)1;
+
+/**
+ * Tagged head of a SLAB stack: the address bits 12..47 of a
+ * page aligned slabStruct and a tag changed by every push and
+ * pop, so a pop racing with a pop and a push of the same SLAB
+ * fails its compare and swap instead of linking a stale next
+ **/
+uint64_t stack_head(slabStruct *slab, uint64_t tag) {
+    return tag << 36 | (uintptr_t)slab >> 12;
+}
+
+slabStruct *stack_slab(uint64_t head) {
+    return (slabStruct*)((head & (((uint64_t)1 << 36) - 1)) << 12);
+}
+
+void push_slab(struct cache *cache, slabStruct *slab) {
+    auto &stack = cache->nodes[slab->node].slab_stack;
+    uint64_t head = stack.load(std::memory_order_relaxed);
+    do {
+        slab->stack_next.store(stack_slab(head), std::memory_order_relaxed);
+    } while (!stack.compare_exchange_weak(head, stack_head(slab, (head >> 36) + 1),
+                                          std::memory_order_release, std::memory_order_relaxed));
+}
+
+/**
+ * Takes a SLAB off the stack of a node, nullptr if it is
+ * empty. The next link of a SLAB popped and released by
+ * another thread meanwhile is read from the arena, which
+ * stays mapped, and is then discarded by the failed swap
+ **/
+slabStruct *pop_slab(cache_node *node) {
+    uint64_t head = node->slab_stack.load(std::memory_order_acquire);
+    while (auto slab = stack_slab(head)) {
+        auto next = slab->stack_next.load(std::memory_order_relaxed);
+        if (node->slab_stack.compare_exchange_weak(head, stack_head(next, (head >> 36) + 1),
+                                                   std::memory_order_acquire, std::memory_order_acquire)) {
+            return slab;
+        }
+    }
+    return nullptr;
+}
+
+/**
+ * Moves objects freed by other threads to the free list of a
+ * SLAB of a SLAB_CONCURRENT cache, by the thread holding it
+ **/
+void take_remote_frees(struct cache *cache, slabStruct *slab) {
+    void *object = slab->remote_free.exchange(nullptr, std::memory_order_acquire);
+    while (object) {
+        void *next = get_free_pointer(cache, object);
+        set_free_pointer(cache, object, slab->free_object);
+        slab->free_object = object;
+        slab->refcnt -= 1;
+        object = next;
+    }
+}
+
+/**
+ * Gives up a SLAB the calling thread allocated from: one with
+ * free objects goes to the stack of its node, a full one is
+ * detached and the first free to it pushes it back
+ **/
+void release_slab(struct cache *cache, slabStruct *slab) {
+    void *expected = nullptr;
+    if (!slab->free_object && slab->remote_free.compare_exchange_strong(expected, slab_detached,
+                                                                       std::memory_order_acq_rel)) {
+        return;
+    }
+    take_remote_frees(cache, slab);
+    push_slab(cache, slab);
+}
+
+/**
+ * A SLAB with free objects for the calling thread, popped from
+ * the stack of the current NUMA node or, only then under
+ * cache->lock, a new one. Stacks of other nodes are tried if
+ * no memory is left. Returns nullptr when the memory is over
+ **/
+slabStruct *acquire_slab(struct cache *cache) {
+    int current = current_numa_node();
+    slabStruct *slab = pop_slab(&cache->nodes[current]);
+
+    if (!slab && cache->slab_objects) {
+        std::lock_guard<std::mutex> guard(cache->lock);
+        if ((slab = create_slab(cache, current))) {
+            link_slab(&cache->nodes[current].slabs, slab);
+            cache->nodes[current].slab_count += 1;
+        }
+    }
+
+    for (int i = 0; !slab && i < numa_node_count(); ++i) {
+        slab = pop_slab(&cache->nodes[i]);
+    }
+
+    if (slab) {
+        take_remote_frees(cache, slab);
+    }
+    return slab;
+}
+
+/**
+ * cache_alloc of a SLAB_CONCURRENT cache: every thread index
+ * allocates from a SLAB of its own without locks and trades
+ * it for another one through the stacks once it is full.
+ * Threads without an index hold a SLAB for one object
+ **/
+void *concurrent_alloc(struct cache *cache) {
+    int index = current_thread_index();
+    auto slab = index >= 0 ? cache->thread_slabs[index].load(std::memory_order_relaxed) : nullptr;
+
+    if (slab && !slab->free_object) {
+        take_remote_frees(cache, slab);
+    }
+    if (!slab || !slab->free_object) {
+        if (slab) {
+            release_slab(cache, slab);
+        }
+        slab = acquire_slab(cache);
+        if (index >= 0) {
+            cache->thread_slabs[index].store(slab, std::memory_order_relaxed);
+        }
+        if (!slab) {
+            return nullptr;
+        }
+    }
+
+    void *object = pop_free_object(cache, slab);
+    if (index < 0) {
+        release_slab(cache, slab);
+    }
+    return object;
+}
+
+/**
+ * cache_free of a SLAB_CONCURRENT cache: objects of the SLAB
+ * of the calling thread go straight to its free list, the other
+ * ones to the remote_free list of their SLAB. The free which
+ * finds a SLAB detached pushes it to the stack of its node
+ **/
+void concurrent_free(struct cache *cache, slabStruct *slab, void *ptr) {
+    int index = current_thread_index();
+    if (index >= 0 && cache->thread_slabs[index].load(std::memory_order_relaxed) == slab) {
+        set_free_pointer(cache, ptr, slab->free_object);
+        slab->free_object = ptr;
+        slab->refcnt -= 1;
+        return;
+    }
+
+    void *head = slab->remote_free.load(std::memory_order_relaxed);
+    do {
+        set_free_pointer(cache, ptr, head == slab_detached ? nullptr : head);
+    } while (!slab->remote_free.compare_exchange_weak(head, ptr, std::memory_order_acq_rel, std::memory_order_relaxed));
+
+    if (head == slab_detached) {
+        push_slab(cache, slab);
+    }
+}
+
+/**
+ * Releases up to `max_slabs` free SLABs of the stacks of a
+ * SLAB_CONCURRENT cache beyond `kept` per node, the SLABs
+ * live threads allocate from stay, and the expired idle SLABs.
+ * SLABs finished threads left go back to the stacks first.
+ * The stacks are emptied for the time of the scan.
+ * Returns the count of released SLABs
+ **/
+size_t shrink_concurrent(struct cache *cache, size_t max_slabs, size_t kept) {
+    size_t released = 0;
+    std::vector<slabStruct*> taken;
+
+    // nobody can take a free index while the lock is held, like the magazines of flush_magazines
+    {
+        std::lock_guard<std::mutex> guard(thread_index_lock);
+        for (size_t i = 0; i < max_magazine_threads; ++i) {
+            if (!thread_index_used[i]) {
+                if (auto slab = cache->thread_slabs[i].exchange(nullptr, std::memory_order_acq_rel)) {
+                    taken.push_back(slab);
+                }
+            }
+        }
+    }
+    for (auto slab : taken) {
+        release_slab(cache, slab);
+    }
+
+    std::lock_guard<std::mutex> guard(cache->lock);
+    for (auto &node : cache->nodes) {
+        taken.clear();
+        while (auto slab = pop_slab(&node)) {
+            take_remote_frees(cache, slab);
+            taken.push_back(slab);
+        }
+
+        size_t free_slabs = 0;
+        for (auto slab : taken) {
+            if (slab->refcnt == 0 && free_slabs++ >= kept && released < max_slabs) {
+                unlink_slab(&node.slabs, slab);
+                node.slab_count -= 1;
+                shrink_slab(cache, slab);
+                released += 1;
+            } else {
+                push_slab(cache, slab);
+            }
+        }
+    }
+
+    return released + expire_idle_slabs(cache, max_slabs - released, cache->idle_timeout);
+}
+
+#ifdef SLAB_STATS
+/**
+ * Counters of the calling thread, nullptr for threads without
+ * an index, they count in cache->shared_allocs and shared_frees
+ **/
+cache_thread_stats *current_stats(struct cache *cache) {
+    int index = current_thread_index();
+    if (index < 0) {
+        return nullptr;
+    }
+
+    auto stats = cache->thread_stats[index].load(std::memory_order_acquire);
+    if (!stats) {
+        auto memory = aligned_alloc(alignof(cache_thread_stats), sizeof(cache_thread_stats));
+        stats = new (memory) cache_thread_stats();
+        cache->thread_stats[index].store(stats, std::memory_order_release);
+    }
+    return stats;
+}
+
+/**
+ * Adds to a counter only the calling thread changes,
+ * a relaxed load and store take no bus lock
+ **/
+void add_stat(std::atomic<uint64_t> &counter, size_t count) {
+    counter.store(counter.load(std::memory_order_relaxed) + count, std::memory_order_relaxed);
+}
+#endif
+
+#ifdef SLAB_TRACE
+/**
+ * State of the trace of slab_trace_start. Caches and live
+ * objects get small ids in the order they show up, ids of
+ * freed objects are reused, so a replay keeps a dense table
+ **/
+struct trace_state {
+    std::mutex lock;
+    FILE *file;
+    std::chrono::steady_clock::time_point start;
+    std::unordered_map<struct cache*, uint16_t> caches;
+    uint16_t next_cache;
+    std::unordered_map<void*, uint32_t> objects;
+    std::vector<uint32_t> free_ids;
+    uint32_t next_object;
+};
+
+std::atomic<bool> trace_active;
+
+trace_state &get_trace() {
+    // never destroyed: traced threads may outlive static objects
+    static auto state = new trace_state();
+    return *state;
+}
+
+void write_record(trace_state &state, uint8_t op, uint16_t cache, uint32_t object, uint8_t flags = 0) {
+    trace_record record{};
+    record.op = op;
+    record.flags = flags;
+    record.cache = cache;
+    record.object = object;
+    record.timestamp = (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - state.start).count();
+    fwrite(&record, sizeof(record), 1, state.file);
+}
+
+/**
+ * Id of a cache, a cache seen for the first time is recorded as set
+ * up with the size, alignment and flags of its setup, less the
+ * flags a replay can't have. state.lock must be held
+ **/
+uint16_t trace_cache_id(trace_state &state, struct cache *cache) {
+    auto found = state.caches.find(cache);
+    if (found != state.caches.end()) {
+        return found->second;
+    }
+
+    uint16_t id = state.next_cache++;
+    state.caches[cache] = id;
+    uint32_t align_order = 0;
+    while (align_order < 12 && ((size_t)1 << align_order) < cache->requested_align) {
+        align_order += 1;
+    }
+    write_record(state, trace_setup, id, (uint32_t)cache->requested_size | align_order << trace_align_shift,
+                 (uint8_t)(cache->flags & ~SLAB_PERSISTENT));
+    return id;
+}
+
+/**
+ * Records `count` allocations or frees. Frees are recorded before
+ * the objects are freed and allocations after they are taken, so
+ * the log orders the reuse of an address after its free
+ **/
+void trace_objects(struct cache *cache, uint8_t op, void **objects, size_t count) {
+    auto &state = get_trace();
+    std::lock_guard<std::mutex> guard(state.lock);
+    if (!state.file) {
+        return;
+    }
+
+    uint16_t id = trace_cache_id(state, cache);
+    for (size_t i = 0; i < count; ++i) {
+        uint32_t object;
+        if (op == trace_alloc) {
+            if (!state.free_ids.empty()) {
+                object = state.free_ids.back();
+                state.free_ids.pop_back();
+            } else {
+                object = state.next_object++;
+            }
+            state.objects[objects[i]] = object;
+        } else {
+            // objects allocated before the trace started can't be replayed
+            auto found = state.objects.find(objects[i]);
+            if (found == state.objects.end()) {
+                continue;
+            }
+            object = found->second;
+            state.objects.erase(found);
+            state.free_ids.push_back(object);
+        }
+        write_record(state, op, id, object);
+    }
+}
+
+/**
+ * Records cache_shrink and cache_release of a traced cache
+ **/
+void trace_cache(struct cache *cache, uint8_t op) {
+    auto &state = get_trace();
+    std::lock_guard<std::mutex> guard(state.lock);
+    if (!state.file) {
+        return;
+    }
+
+    auto found = state.caches.find(cache);
+    if (found == state.caches.end()) {
+        return;
+    }
+    write_record(state, op, found->second, 0);
+    if (op == trace_release) {
+        state.caches.erase(found);
+    }
+}
+#endif
+
+/**
+ * Counts, traces and checks objects handed out to the application
+ **/
+void note_allocs(struct cache *cache, void **objects, size_t count) {
+    if (cache->debug_size) {
+        debug_allocs(cache, objects, count);
+    }
+
+#ifdef SLAB_TRACE
+    if (count && trace_active.load(std::memory_order_relaxed)) {
+        trace_objects(cache, trace_alloc, objects, count);
+    }
+#endif
+
+#ifdef SLAB_STATS
+    if (auto stats = current_stats(cache)) {
+        add_stat(stats->allocs, count);
+    } else {
+        cache->shared_allocs.fetch_add(count, std::memory_order_relaxed);
+    }
+#endif
+}
+
+/**
+ * Counts and traces objects given back by the application
+ **/
+void note_frees(struct cache *cache, void **objects, size_t count) {
+    // builds without SLAB_TRACE and SLAB_STATS don't note frees
+    (void)cache;
+    (void)objects;
+    (void)count;
+#ifdef SLAB_TRACE
+    if (count && trace_active.load(std::memory_order_relaxed)) {
+        trace_objects(cache, trace_free, objects, count);
+    }
+#endif
+
+#ifdef SLAB_STATS
+    if (auto stats = current_stats(cache)) {
+        add_stat(stats->frees, count);
+    } else {
+        cache->shared_frees.fetch_add(count, std::memory_order_relaxed);
+    }
+#endif
+}
+
+/**
+ * Takes up to `n` objects from SLABs under a single lock,
+ * for the layers above them. Returns the count of taken objects
+ **/
+size_t slab_alloc_bulk(struct cache *cache, void **out, size_t n)
+{
+    int thread = current_thread_index();
+    std::lock_guard<std::mutex> guard(cache->lock);
+    collect_remote_frees(cache);
+    return slab_alloc_objects(cache, out, n, thread);
+}
+
+/**
+ * Returns `n` objects to their SLABs under a single lock
+ **/
+void slab_free_bulk(struct cache *cache, void **ptrs, size_t n)
+{
+    std::lock_guard<std::mutex> guard(cache->lock);
+    slab_free_objects(cache, ptrs, n);
+}
+
+/**
+ * The function of allocation of `n` objects at once, it
+ * fills `out` straight from SLABs under a single lock
+ * bypassing magazines. Returns the count of allocated objects,
+ * less than `n` only if the memory is over
+ **/
+size_t cache_alloc_bulk(struct cache *cache, void **out, size_t n)
+{
+    size_t allocated = 0;
+    if (cache->flags & SLAB_CONCURRENT) {
+        // the SLAB of the thread serves them without the lock anyway
+        while (allocated < n && (out[allocated] = concurrent_alloc(cache))) {
+            allocated += 1;
+        }
+    } else {
+        allocated = slab_alloc_bulk(cache, out, n);
+    }
+    note_allocs(cache, out, allocated);
+    return allocated;
+}
+
+/**
+ * The function of freeing `n` objects at once straight into
+ * their SLABs under a single lock. Objects of one SLAB placed
+ * one after another in `ptrs` are freed together.
+ * It is guaranteed that all of ptrs were returned from
+ * cache_alloc or cache_alloc_bulk, debug caches drop the
+ * pointers failing their checks from `ptrs`
+ **/
+void cache_free_bulk(struct cache *cache, void **ptrs, size_t n)
+{
+    if (cache->debug_size) {
+        n = check_frees(cache, ptrs, n);
+    }
+    note_frees(cache, ptrs, n);
+    if (cache->flags & SLAB_CONCURRENT) {
+        for (size_t i = 0; i < n; ++i) {
+            concurrent_free(cache, calculate_slab_start(cache, ptrs[i]), ptrs[i]);
+        }
+        return;
+    }
+    slab_free_bulk(cache, ptrs, n);
+}
+
+/**
+ * Bit i of the result is set when `k` bits of `word` from bit i on
+ * are set, in log(k) shifts: every step doubles the checked run
+ **/
+uint64_t slot_runs(uint64_t word, size_t k) {
+    size_t run = 1;
+    while (run < k) {
+        size_t shift = std::min(run, k - run);
+        word &= word >> shift;
+        run += shift;
+    }
+    return word;
+}
+
+/**
+ * Takes `k` adjacent free slots of one bitmap word of a SLAB,
+ * `first` receives the index of the first one. Returns false
+ * if no word has such a run. cache->lock must be held
+ **/
+bool take_slot_run(struct cache *cache, slabStruct *slab, size_t k, size_t *first) {
+    for (size_t i = slab->bitmap_hint; i < cache->bitmap_words; ++i) {
+        if (uint64_t runs = slot_runs(slab->bitmap[i], k)) {
+            size_t bit = __builtin_ctzll(runs);
+            uint64_t mask = k == 64 ? ~(uint64_t)0 : ((uint64_t)1 << k) - 1;
+            slab->bitmap[i] &= ~(mask << bit);
+            slab->refcnt += k;
+            *first = i * 64 + bit;
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * The function of allocation of `k` adjacent objects of a
+ * SLAB_BITMAP cache, k up to 64, bypassing magazines. The run
+ * never crosses a 64 object boundary of its SLAB. The objects
+ * may be freed one by one or with cache_free_contiguous.
+ * Returns the first object, nullptr if the cache has no
+ * bitmaps, k is out of range or the memory is over
+ **/
+void *cache_alloc_contiguous(struct cache *cache, size_t k)
+{
+    if (!cache->bitmap_words || !k || k > 64 || k > cache->slab_objects) {
+        return nullptr;
+    }
+
+    void *objects[64];
+    {
+        int thread = current_thread_index();
+        std::lock_guard<std::mutex> guard(cache->lock);
+        int current = current_numa_node();
+        cache_node *node = &cache->nodes[current];
+        slabStruct *slab = nullptr;
+        size_t first = 0;
+
+        // the fullest SLAB with a run first, like slab_alloc_objects
+        for (unsigned bin = partial_bin_count; bin > 0 && !slab; --bin) {
+            for (auto candidate = node->partially_slabs[bin - 1]; candidate; candidate = candidate->next) {
+                if (take_slot_run(cache, candidate, k, &first)) {
+                    slab = candidate;
+                    break;
+                }
+            }
+        }
+
+        bool was_partial = slab != nullptr;
+        if (!slab) {
+            if ((slab = node->complete_slab)) {
+                remove_from_complete_list(node, slab);
+            } else if (!(slab = create_slab(cache, current))) {
+                return nullptr;
+            }
+            slab->owner.store(thread, std::memory_order_relaxed);
+            // the first word of a free SLAB holds min(64, slab_objects) free slots
+            take_slot_run(cache, slab, k, &first);
+        }
+        relink_allocated_slab(cache, node, slab, was_partial);
+
+        for (size_t i = 0; i < k; ++i) {
+            objects[i] = slab->objects + (first + i) * cache->object_size;
+        }
+    }
+
+    note_allocs(cache, objects, k);
+    return objects[0];
+}
+
+/**
+ * The function of freeing `k` adjacent objects of
+ * cache_alloc_contiguous starting at `ptr` at once. A `ptr`
+ * that doesn't start a run of `k` objects within one 64 object
+ * word of a SLAB of the cache is reported and dropped
+ **/
+void cache_free_contiguous(struct cache *cache, void *ptr, size_t k)
+{
+    if (!cache->bitmap_words || !k || k > 64 || k > cache->slab_objects) {
+        return;
+    }
+    auto slab = slab_lookup(ptr);
+    bool held = slab && slab->cache == cache && slab_holds(cache, slab, ptr);
+    size_t first = held ? slot_index(cache, slab, ptr) : 0;
+    if (!held || first % 64 + k > 64 || first + k > cache->slab_objects) {
+        report_corruption(cache, "free of a foreign run at", ptr);
+        return;
+    }
+
+    void *objects[64];
+    for (size_t i = 0; i < k; ++i) {
+        objects[i] = (uint8_t*)ptr + i * cache->object_size;
+    }
+    if (cache->debug_size && (k = check_frees(cache, objects, k)) == 0) {
+        return;
+    }
+    note_frees(cache, objects, k);
+
+    std::lock_guard<std::mutex> guard(cache->lock);
+    if (cache->debug_size) {
+        // the checks may have dropped objects out of the middle of the run
+        slab_free_run(cache, slab, objects, k);
+    } else {
+        slab_free_slots(cache, slab, first, k);
+    }
+}
+
+/**
+ * Magazines of the calling thread, nullptr if the cache
+ * doesn't use magazines or there are too many threads
+ **/
+thread_magazines *current_magazines(struct cache *cache) {
+    if (!cache->magazine_size) {
+        return nullptr;
+    }
+
+    int index = current_thread_index();
+    if (index < 0) {
+        return nullptr;
+    }
+
+    auto magazines = cache->magazines[index].load(std::memory_order_acquire);
+    if (!magazines) {
+        // aligned to keep magazines of different threads on different cache lines
+        magazines = (thread_magazines*)aligned_alloc(alignof(thread_magazines), sizeof(thread_magazines));
+        magazines->loaded = new magazine();
+        magazines->previous = new magazine();
+        cache->magazines[index].store(magazines, std::memory_order_release);
+    }
+
+    return magazines;
+}
+
+void *magazine_alloc(struct cache *cache, thread_magazines *magazines) {
+    if (auto rounds = magazines->loaded->rounds) {
+        // the object after this one is written by the next allocation
+        if (rounds > 1) {
+            __builtin_prefetch(magazines->loaded->objects[rounds - 2], 1);
+        }
+        magazines->loaded->rounds = rounds - 1;
+        return magazines->loaded->objects[rounds - 1];
+    }
+
+    if (magazines->previous->rounds) {
+        std::swap(magazines->loaded, magazines->previous);
+        return magazines->loaded->objects[--magazines->loaded->rounds];
+    }
+
+    // both magazines are empty, exchange one for a full magazine of the depot
+    magazine *full = nullptr;
+    {
+        std::lock_guard<std::mutex> guard(cache->depot_lock);
+        if ((full = cache->full_magazines)) {
+            cache->full_magazines = full->next;
+            cache->full_magazines_count -= 1;
+
+            magazines->previous->next = cache->empty_magazines;
+            cache->empty_magazines = magazines->previous;
+        }
+    }
+
+    if (full) {
+        magazines->previous = magazines->loaded;
+        magazines->loaded = full;
+    } else {
+        // the depot is out of objects too, refill from SLABs
+        auto loaded = magazines->loaded;
+        loaded->rounds = slab_alloc_bulk(cache, loaded->objects, cache->magazine_size);
+        if (!loaded->rounds) {
+            return nullptr;
+        }
+    }
+
+    return magazines->loaded->objects[--magazines->loaded->rounds];
+}
+
+void magazine_free(struct cache *cache, thread_magazines *magazines, void *ptr) {
+    if (magazines->loaded->rounds < cache->magazine_size) {
+        magazines->loaded->objects[magazines->loaded->rounds++] = ptr;
+        return;
+    }
+
+    if (magazines->previous->rounds < cache->magazine_size) {
+        std::swap(magazines->loaded, magazines->previous);
+        magazines->loaded->objects[magazines->loaded->rounds++] = ptr;
+        return;
+    }
+
+    // both magazines are full, give one to the depot for an empty one
+    bool drain = false;
+    {
+        std::lock_guard<std::mutex> guard(cache->depot_lock);
+        if (cache->full_magazines_count < depot_full_limit) {
+            magazines->previous->next = cache->full_magazines;
+            cache->full_magazines = magazines->previous;
+            cache->full_magazines_count += 1;
+
+            if ((magazines->previous = cache->empty_magazines)) {
+                cache->empty_magazines = magazines->previous->next;
+            }
+        } else {
+            drain = true;
+        }
+    }
+
+    if (drain) {
+        // the depot is full enough, return the objects to SLABs
+        slab_free_bulk(cache, magazines->previous->objects, magazines->previous->rounds);
+        magazines->previous->rounds = 0;
+    } else if (!magazines->previous) {
+        magazines->previous = new magazine();
+    }
+
+    std::swap(magazines->loaded, magazines->previous);
+    magazines->loaded->objects[magazines->loaded->rounds++] = ptr;
+}
+
+#ifdef SLAB_USE_RSEQ
+#define RSEQ_STRINGIFY(x) #x
+#define RSEQ_STR(x) RSEQ_STRINGIFY(x)
+
+/**
+ * Opens an rseq critical section 1..2 aborting to the
+ * `aborted` label and leaves the address of the current
+ * CPU's stack in rax
+ **/
+#define RSEQ_CRITICAL_SECTION_START \
+    ".pushsection __rseq_cs, \"aw\"\n\t" \
+    ".balign 32\n\t" \
+    "3:\n\t" \
+    ".long 0x0, 0x0\n\t" \
+    ".quad 1f, (2f - 1f), 4f\n\t" \
+    ".popsection\n\t" \
+    "leaq 3b(%%rip), %%rax\n\t" \
+    "movq %%rax, %[rseq_cs]\n\t" \
+    "1:\n\t" \
+    "movl %[cpu_id], %%eax\n\t" \
+    "imulq %[stride], %%rax, %%rax\n\t" \
+    "addq %[stacks], %%rax\n\t"
+
+/* the last instruction before this one is the commit */
+#define RSEQ_CRITICAL_SECTION_END \
+    "2:\n\t" \
+    ".pushsection __rseq_failure, \"ax\"\n\t" \
+    ".byte 0x0f, 0xb9, 0x3d\n\t" \
+    ".long " RSEQ_STR(RSEQ_SIG) "\n\t" \
+    "4:\n\t" \
+    "jmp %l[aborted]\n\t" \
+    ".popsection\n\t"
+
+/* rseq area glibc registered for the calling thread */
+struct rseq *current_rseq() {
+    return (struct rseq*)((uint8_t*)__builtin_thread_pointer() + __rseq_offset);
+}
+
+bool rseq_available() {
+    return __rseq_size > 0 && (int32_t)current_rseq()->cpu_id >= 0;
+}
+
+/**
+ * Pops an object from the stack of the current CPU,
+ * false if the stack is empty
+ **/
+bool cpu_stack_pop(cpu_stack *stacks, void **object) {
+    auto rseq = current_rseq();
+
+    for (;;) {
+        __asm__ __volatile__ goto (
+            RSEQ_CRITICAL_SECTION_START
+            "movq (%%rax), %%rcx\n\t"
+            "testq %%rcx, %%rcx\n\t"
+            "jz %l[empty]\n\t"
+            "movq (%%rax, %%rcx, 8), %%rdx\n\t"
+            "movq %%rdx, (%[object])\n\t"
+            "decq %%rcx\n\t"
+            "movq %%rcx, (%%rax)\n\t"
+            RSEQ_CRITICAL_SECTION_END
+            :
+            : [cpu_id] "m" (rseq->cpu_id), [rseq_cs] "m" (rseq->rseq_cs),
+              [stacks] "r" (stacks), [stride] "i" (sizeof(cpu_stack)), [object] "r" (object)
+            : "memory", "cc", "rax", "rcx", "rdx"
+            : empty, aborted);
+        return true;
+    aborted:
+        // preempted, migrated or signaled in the middle, try again
+        continue;
+    }
+
+empty:
+    return false;
+}
+
+/**
+ * Pushes an object onto the stack of the current CPU,
+ * false if the stack already holds `capacity` objects
+ **/
+bool cpu_stack_push(cpu_stack *stacks, size_t capacity, void *object) {
+    auto rseq = current_rseq();
+
+    for (;;) {
+        __asm__ __volatile__ goto (
+            RSEQ_CRITICAL_SECTION_START
+            "movq (%%rax), %%rcx\n\t"
+            "cmpq %[capacity], %%rcx\n\t"
+            "jae %l[full]\n\t"
+            "movq %[object], 8(%%rax, %%rcx, 8)\n\t"
+            "incq %%rcx\n\t"
+            "movq %%rcx, (%%rax)\n\t"
+            RSEQ_CRITICAL_SECTION_END
+            :
+            : [cpu_id] "m" (rseq->cpu_id), [rseq_cs] "m" (rseq->rseq_cs),
+              [stacks] "r" (stacks), [stride] "i" (sizeof(cpu_stack)),
+              [capacity] "r" (capacity), [object] "r" (object)
+            : "memory", "cc", "rax", "rcx"
+            : full, aborted);
+        return true;
+    aborted:
+        continue;
+    }
+
+full:
+    return false;
+}
+
+void *cpu_cache_alloc(struct cache *cache) {
+    void *object;
+    if (cpu_stack_pop(cache->cpu_stacks, &object)) {
+        return object;
+    }
+
+    // the stack of this CPU is empty, refill a half of it from SLABs
+    void *batch[max_magazine_size];
+    size_t count = slab_alloc_bulk(cache, batch, cache->magazine_size / 2);
+    if (!count) {
+        return nullptr;
+    }
+
+    size_t pushed = 1;
+    while (pushed < count && cpu_stack_push(cache->cpu_stacks, cache->magazine_size, batch[pushed])) {
+        pushed += 1;
+    }
+    // the thread moved to a CPU with a full stack
+    if (pushed < count) {
+        slab_free_bulk(cache, batch + pushed, count - pushed);
+    }
+
+    return batch[0];
+}
+
+void cpu_cache_free(struct cache *cache, void *ptr) {
+    while (!cpu_stack_push(cache->cpu_stacks, cache->magazine_size, ptr)) {
+        // the stack of this CPU is full, drain a half of it into SLABs
+        void *batch[max_magazine_size];
+        size_t count = 0;
+        while (count < cache->magazine_size / 2 && cpu_stack_pop(cache->cpu_stacks, &batch[count])) {
+            count += 1;
+        }
+        slab_free_bulk(cache, batch, count);
+    }
+}
+#endif
+
+void delete_magazines(magazine *list) {
+    while (list) {
+        magazine *next = list->next;
+        delete list;
+        list = next;
+    }
+}
+
+void flush_thread_magazines(struct cache *cache, thread_magazines *magazines) {
+    slab_free_bulk(cache, magazines->loaded->objects, magazines->loaded->rounds);
+    slab_free_bulk(cache, magazines->previous->objects, magazines->previous->rounds);
+    magazines->loaded->rounds = 0;
+    magazines->previous->rounds = 0;
+}
+
+/**
+ * Frees the magazines of a thread, their objects are lost
+ **/
+void free_thread_magazines(thread_magazines *magazines) {
+    delete magazines->loaded;
+    delete magazines->previous;
+    free(magazines);
+}
+
+/**
+ * Returns objects of the calling thread's magazines, of
+ * magazines left by finished threads, of the current CPU's
+ * stack and all the objects in the depot back to SLABs
+ **/
+void flush_magazines(struct cache *cache) {
+#ifdef SLAB_USE_RSEQ
+    // stacks of other CPUs can only be changed by threads running there
+    if (cache->cpu_stacks) {
+        void *object;
+        while (cpu_stack_pop(cache->cpu_stacks, &object)) {
+            slab_free_bulk(cache, &object, 1);
+        }
+    }
+#endif
+
+    // the calling thread may have no magazines, a reclaimer thread doesn't get them
+    int index = current_thread_index();
+    if (index >= 0) {
+        if (auto magazines = cache->magazines[index].load(std::memory_order_acquire)) {
+            flush_thread_magazines(cache, magazines);
+        }
+    }
+
+    // nobody can take a free index while the lock is held, the magazines of finished threads are
+    // taken under it and flushed after it: thread_index_lock is never held while cache->lock is taken
+    std::vector<thread_magazines*> orphaned;
+    {
+        std::lock_guard<std::mutex> guard(thread_index_lock);
+        for (size_t i = 0; i < max_magazine_threads; ++i) {
+            if (!thread_index_used[i]) {
+                if (auto magazines = cache->magazines[i].exchange(nullptr, std::memory_order_acq_rel)) {
+                    orphaned.push_back(magazines);
+                }
+            }
+        }
+    }
+    for (auto magazines : orphaned) {
+        flush_thread_magazines(cache, magazines);
+        free_thread_magazines(magazines);
+    }
+
+    magazine *full;
+    magazine *empty;
+    {
+        std::lock_guard<std::mutex> guard(cache->depot_lock);
+        full = cache->full_magazines;
+        empty = cache->empty_magazines;
+        cache->full_magazines = nullptr;
+        cache->empty_magazines = nullptr;
+        cache->full_magazines_count = 0;
+    }
+
+    for (auto current = full; current; current = current->next) {
+        slab_free_bulk(cache, current->objects, current->rounds);
+    }
+
+    delete_magazines(full);
+    delete_magazines(empty);
+}
+
+/**
+ * The same as cache_setup with objects aligned on `align`
+ * bytes, a power of two up to 4096 or 0 for the pointer
+ * alignment, and SLAB_* flags changing the behaviour of the cache:
+ *  - SLAB_HUGEPAGE - SLABs come from an arena of huge
+ *  pages, either MAP_HUGETLB or transparent ones
+ *  - SLAB_HWCACHE_ALIGN - objects are aligned on cache lines,
+ *  small ones on the smallest fraction of a line holding them,
+ *  so no two objects share a line without need
+ *  - SLAB_CONCURRENT - for caches shared by many threads: no
+ *  magazines, every thread allocates from a SLAB of its own
+ *  and takes partially occupied ones from lock-free stacks
+ *  instead of the SLAB lists, cache->lock is taken only for new
+ *  SLABs and shrinks. The slabStruct always stays in the SLAB
+ *  - SLAB_BITMAP - free objects are tracked by a bitmap after
+ *  the slabStruct and found with ctz a 64-bit word at a time,
+ *  so objects have no minimum size and cache_alloc_contiguous
+ *  can take runs of adjacent slots. Ignored with SLAB_CONCURRENT
+ *  - SLAB_RED_ZONE - every object is followed by at least 8
+ *  guarded bytes telling allocated objects from free ones, so
+ *  overflows, double frees and frees of foreign pointers are
+ *  reported to stderr and counted, bad frees are dropped
+ *  - SLAB_POISON - free objects are filled with a pattern,
+ *  allocations check it for writes after free. Without
+ *  SLAB_RED_ZONE frees of objects still poisoned are taken
+ *  for double frees. Ignored with a `ctor`
+ *  - SLAB_PERSISTENT - set by cache_attach: SLABs come from the
+ *  arena of a file, always with their slabStruct, no magazines
+ * Optional `ctor` is called for every object of a new SLAB and
+ * `dtor` for every object of a SLAB released by cache_shrink or
+ * cache_release, objects keep their state between cache_free
+ * and the next cache_alloc
+ **/
+void cache_setup_ex(struct cache *cache, size_t object_size, size_t align, unsigned flags,
+                    void (*ctor)(void *), void (*dtor)(void *))
+{
+    cache->requested_size = object_size;
+    cache->requested_align = align;
+    // constructed objects keep their state while they are free, poison would destroy it
+    if (ctor) {
+        flags &= ~SLAB_POISON;
+    }
+    // cache_attach sets the arena of the file up beforehand
+    if (!(flags & SLAB_PERSISTENT)) {
+        cache->arena = flags & SLAB_HUGEPAGE ? huge_arena() : default_arena();
+    }
+    // tagged SLAB stacks keep the address bits 12..47, arenas mapped past them by 5-level paging take the lock
+    if ((flags & SLAB_CONCURRENT) && (uintptr_t)cache->arena->start + cache->arena->size > (uint64_t)1 << 48) {
+        flags &= ~SLAB_CONCURRENT;
+    }
+    cache->flags = flags;
+    cache->ctor = ctor;
+    cache->dtor = dtor;
+
+    for (auto &node : cache->nodes) {
+        node.complete_slab = nullptr;
+        for (auto &list : node.partially_slabs) {
+            list = nullptr;
+        }
+        node.empty_slab = nullptr;
+
+        node.complete_count = 0;
+        node.partially_count = 0;
+        node.empty_count = 0;
+        node.partially_mask = 0;
+        node.complete_low = 0;
+
+        node.cursor = nullptr;
+
+        node.slab_stack.store(0, std::memory_order_relaxed);
+        node.slabs = nullptr;
+        node.slab_count = 0;
+
+        node.idle_slab = nullptr;
+        node.idle_count = 0;
+    }
+    for (auto &slab : cache->thread_slabs) {
+        slab.store(nullptr, std::memory_order_relaxed);
+    }
+    cache->free_slabs_kept = default_free_slabs_kept;
+    cache->idle_timeout = 0;
+    cache->migrate = nullptr;
+
+    // SLABs of SLAB_CONCURRENT caches pass free objects between threads in lists
+    bool bitmap = (flags & SLAB_BITMAP) && !(flags & SLAB_CONCURRENT);
+
+    // every free object stores the pointer to the next one, bitmap slots take any size
+    if (object_size < (bitmap ? 1 : sizeof(void*))) {
+        object_size = bitmap ? 1 : sizeof(void*);
+    }
+
+    // the redzone takes the bytes past the requested size up to the end of the next 8 byte word
+    bool debug = flags & (SLAB_RED_ZONE | SLAB_POISON);
+    cache->debug_size = debug ? std::max<size_t>(cache->requested_size, 1) : 0;
+    cache->red_zone_offset = 0;
+    if (flags & SLAB_RED_ZONE) {
+        cache->red_zone_offset = (cache->debug_size + sizeof(uint64_t) - 1) & ~(sizeof(uint64_t) - 1);
+        object_size = cache->red_zone_offset + sizeof(uint64_t);
+    }
+    cache->corruptions.store(0, std::memory_order_relaxed);
+#ifdef SLAB_FREELIST_HARDENED
+    if (getrandom(&cache->freelist_random, sizeof(cache->freelist_random), 0) != sizeof(cache->freelist_random)) {
+        cache->freelist_random = (uintptr_t)cache ^ (uintptr_t)std::chrono::steady_clock::now().time_since_epoch().count();
+    }
+#endif
+
+    if (flags & SLAB_HWCACHE_ALIGN) {
+        size_t line_align = cache_line_size;
+        while (object_size <= line_align / 2) {
+            line_align /= 2;
+        }
+        align = std::max(align, line_align);
+    }
+    // tiny bitmap slots are aligned on the largest power of two dividing their size
+    cache->align = bitmap ? std::min(object_size & (0 - object_size), sizeof(void*)) : sizeof(void*);
+    while (cache->align < align && cache->align < 4096) {
+        cache->align <<= 1;
+    }
+
+    // the free pointer of constructed and checked objects follows the object and its redzone
+    cache->free_offset = 0;
+    if ((ctor || debug) && !bitmap) {
+        cache->free_offset = (object_size + sizeof(void*) - 1) & ~(sizeof(void*) - 1);
+        object_size = cache->free_offset + sizeof(void*);
+    }
+
+    cache->object_size = (object_size + cache->align - 1) & ~(cache->align - 1);
+    object_size = cache->object_size;
+
+    size_t waste = 0;
+    cache->off_slab = false;
+    cache->bitmap_words = 0;
+    cache->colour_next = 0;
+    cache->remote_slabs.store(nullptr, std::memory_order_relaxed);
+    cache->slab_order = calculate_slab_order(object_size, slab_header_size(cache), &cache->slab_objects, &waste);
+
+    // the bitmap in the header takes room of objects, grow it until it covers every object
+    while (bitmap && cache->slab_order >= 0 && cache->bitmap_words * 64 < cache->slab_objects) {
+        cache->bitmap_words = (cache->slab_objects + 63) / 64;
+        cache->slab_order = calculate_slab_order(object_size, slab_header_size(cache), &cache->slab_objects, &waste);
+    }
+
+    // large objects may pack tighter without the slabStruct in the SLAB, like OFF_SLAB caches of Linux,
+    // the tagged stacks of SLAB_CONCURRENT caches need the slabStruct at the page aligned SLAB start,
+    // bitmaps live next to it
+    // off-slab slabStructs live on the heap of the process, SLABs of files keep theirs
+    if (object_size >= off_slab_threshold && !(flags & (SLAB_CONCURRENT | SLAB_PERSISTENT)) && !bitmap) {
+        size_t off_objects = 0;
+        size_t off_waste = 0;
+        int off_order = calculate_slab_order(object_size, 0, &off_objects, &off_waste);
+
+        if (off_order >= 0 && (cache->slab_order < 0 || off_order < cache->slab_order ||
+                (off_order == cache->slab_order && off_waste + slab_header_size(cache) < waste))) {
+            cache->off_slab = true;
+            cache->slab_order = off_order;
+            cache->slab_objects = off_objects;
+        }
+    }
+
+    if (cache->slab_order < 0) {
+        cache->slab_order = 0;
+        cache->slab_objects = 0;
+    }
+
+    // magazines of large objects would hold too much memory per thread, objects of files would die with them,
+    // bitmap frees go straight to the bitmap so it sees every free slot
+    cache->magazine_size = std::min<size_t>(32, 32 * 1024 / object_size);
+    if (cache->magazine_size < 2 || (flags & (SLAB_CONCURRENT | SLAB_PERSISTENT | SLAB_BITMAP))) {
+        cache->magazine_size = 0;
+    }
+
+    for (auto &magazines : cache->magazines) {
+        magazines.store(nullptr, std::memory_order_relaxed);
+    }
+
+#ifdef SLAB_STATS
+    for (auto &stats : cache->thread_stats) {
+        stats.store(nullptr, std::memory_order_relaxed);
+    }
+    cache->shared_allocs.store(0, std::memory_order_relaxed);
+    cache->shared_frees.store(0, std::memory_order_relaxed);
+    cache->slab_allocs = 0;
+    cache->slab_frees = 0;
+    cache->peak_slabs = 0;
+#endif
+
+    cache->full_magazines = nullptr;
+    cache->empty_magazines = nullptr;
+    cache->full_magazines_count = 0;
+
+#ifdef SLAB_USE_RSEQ
+    // per-CPU stacks take the place of magazines when glibc registered rseq
+    cache->cpu_stacks = nullptr;
+    cache->cpu_count = 0;
+    if (cache->magazine_size && rseq_available()) {
+        cache->cpu_count = get_nprocs_conf();
+        cache->cpu_stacks = (cpu_stack*)aligned_alloc(alignof(cpu_stack), sizeof(cpu_stack) * cache->cpu_count);
+        memset(cache->cpu_stacks, 0, sizeof(cpu_stack) * cache->cpu_count);
+    }
+#endif
+
+    // the last step: the reclaimer thread may shrink the cache right away
+    register_cache(cache);
+}
+
+/**
+ * Function of initialization will be called before
+ * using this caching allocator for allocation.
+ * Parameters:
+ *  - cache - structure you need to initialize
+ *  - object_size - the size of the objects
+ *  that this caching allocator should allocate
+ **/
+void cache_setup(struct cache *cache, size_t object_size)
+{
+    cache_setup_ex(cache, object_size, 0, 0, nullptr, nullptr);
+}
+
+/**
+ * Sets the cache up with SLABs of the given order holding
+ * their slabStruct, for callers finding SLABs by alignment
+ **/
+void cache_setup_fixed_order(struct cache *cache, size_t object_size, size_t align, int order)
+{
+    cache_setup_ex(cache, object_size, align, 0, nullptr, nullptr);
+
+    size_t slab_size = (size_t)4096 << order;
+    cache->off_slab = false;
+    cache->slab_order = order;
+
+    size_t header = slab_header_size(cache);
+    cache->slab_objects = slab_size < header + cache->object_size ? 0 : (slab_size - header) / cache->object_size;
+}
+
+/**
+ * The function of release will be called when job
+ * with this allocator will be finished. It must free
+ * all the memory occupied by this allocator.
+ * The checking system will consider
+ * it an error if not all memory is freed
+ **/
+void cache_release(struct cache *cache)
+{
+    // waits for the reclaimer thread to leave the cache
+    unregister_cache(cache);
+
+#ifdef SLAB_TRACE
+    if (trace_active.load(std::memory_order_relaxed)) {
+        trace_cache(cache, trace_release);
+    }
+#endif
+
+    // objects in magazines go away together with their SLABs
+    for (auto &slot : cache->magazines) {
+        if (auto magazines = slot.exchange(nullptr)) {
+            free_thread_magazines(magazines);
+        }
+    }
+
+    delete_magazines(cache->full_magazines);
+    delete_magazines(cache->empty_magazines);
+    cache->full_magazines = nullptr;
+    cache->empty_magazines = nullptr;
+    cache->full_magazines_count = 0;
+
+#ifdef SLAB_USE_RSEQ
+    free(cache->cpu_stacks);
+    cache->cpu_stacks = nullptr;
+    cache->cpu_count = 0;
+#endif
+
+#ifdef SLAB_STATS
+    for (auto &slot : cache->thread_stats) {
+        free(slot.exchange(nullptr));
+    }
+#endif
+
+    // idle SLABs hold no objects to destruct
+    expire_idle_slabs(cache, SIZE_MAX, 0);
+    for (auto &node : cache->nodes) {
+        free_list(cache, node.complete_slab);
+        for (auto &list : node.partially_slabs) {
+            free_list(cache, list);
+            list = nullptr;
+        }
+        free_list(cache, node.empty_slab);
+        free_list(cache, node.slabs);
+
+        node.complete_slab = nullptr;
+        node.empty_slab = nullptr;
+        node.slab_stack.store(0, std::memory_order_relaxed);
+        node.slabs = nullptr;
+        node.slab_count = 0;
+
+        node.complete_count = 0;
+        node.partially_count = 0;
+        node.empty_count = 0;
+        node.partially_mask = 0;
+        node.complete_low = 0;
+    }
+    for (auto &slab : cache->thread_slabs) {
+        slab.store(nullptr, std::memory_order_relaxed);
+    }
+    cache->free_slabs_kept = default_free_slabs_kept;
+    cache->idle_timeout = 0;
+    cache->remote_slabs.store(nullptr, std::memory_order_relaxed);
+}
+
+
+/**
+ * The function of memory allocation from caching allocator.
+ * It should return pointer at the memory chunk with minimum size
+ * of object_size bytes (see cache_setup).
+ * It is guaranteed that the cache points
+ * to the correct initialized allocator.
+ **/
+void *cache_alloc(struct cache *cache)
+{
+    void *object;
+
+    if (cache->flags & SLAB_CONCURRENT) {
+        object = concurrent_alloc(cache);
+        note_allocs(cache, &object, object != nullptr);
+        return object;
+    }
+
+#ifdef SLAB_USE_RSEQ
+    if (cache->cpu_stacks) {
+        object = cpu_cache_alloc(cache);
+        note_allocs(cache, &object, object != nullptr);
+        return object;
+    }
+#endif
+
+    if (auto magazines = current_magazines(cache)) {
+        object = magazine_alloc(cache, magazines);
+    } else {
+        int thread = current_thread_index();
+        std::lock_guard<std::mutex> guard(cache->lock);
+        collect_remote_frees(cache);
+        object = slab_alloc_object(cache, thread);
+    }
+
+    note_allocs(cache, &object, object != nullptr);
+    return object;
+}
+
+/**
+ * The function of allocation of an object from the SLABs of
+ * NUMA node `node`, like kmem_cache_alloc_node of Linux,
+ * bypassing magazines. Other nodes serve it only when no
+ * memory is left for a new SLAB. SLAB_CONCURRENT caches
+ * serve it from the SLAB of the thread. Returns nullptr
+ * for nodes out of [0; node count) or when the memory is over
+ **/
+void *cache_alloc_node(struct cache *cache, int node)
+{
+    if (node < 0 || node >= numa_node_count()) {
+        return nullptr;
+    }
+
+    void *object;
+    if (cache->flags & SLAB_CONCURRENT) {
+        object = concurrent_alloc(cache);
+    } else {
+        int thread = current_thread_index();
+        std::lock_guard<std::mutex> guard(cache->lock);
+        collect_remote_frees(cache);
+        if (!slab_alloc_node_objects(cache, &object, 1, thread, node)) {
+            object = nullptr;
+        }
+    }
+
+    note_allocs(cache, &object, object != nullptr);
+    return object;
+}
+
+
+/**
+ * The function of freeing memory back to the caching allocator.
+ * It is guaranteed that ptr - is a pointer was previously returned from cache_alloc.
+ **/
+void cache_free(struct cache *cache, void *ptr)
+{
+    cache_free_to_slab(cache, calculate_slab_start(cache, ptr), ptr);
+}
+
+/**
+ * cache_free whose caller has already found the slabStruct
+ * of `ptr`: StaticSlabCache with a mask known at compile
+ * time, slab_free with the page map
+ **/
+void cache_free_to_slab(struct cache *cache, slabStruct *slab, void *ptr)
+{
+    if (cache->debug_size) {
+        if (!check_frees(cache, &ptr, 1)) {
+            return;
+        }
+        slab = slab_lookup(ptr);
+    }
+    note_frees(cache, &ptr, 1);
+
+    if (cache->flags & SLAB_CONCURRENT) {
+        concurrent_free(cache, slab, ptr);
+        return;
+    }
+
+#ifdef SLAB_USE_RSEQ
+    if (cache->cpu_stacks) {
+        cpu_cache_free(cache, ptr);
+        return;
+    }
+#endif
+
+    if (auto magazines = current_magazines(cache)) {
+        magazine_free(cache, magazines, ptr);
+        return;
+    }
+
+    // the remote_free list links objects, bitmap slots may have no room for the link
+    if (!cache->bitmap_words && slab->owner.load(std::memory_order_relaxed) != current_thread_index()) {
+        remote_free_object(cache, slab, ptr);
+        return;
+    }
+
+    std::lock_guard<std::mutex> guard(cache->lock);
+    slab_free_run(cache, slab, &ptr, 1);
+}
+
+
+/**
+ * The function must release all SLABs, which
+ * don't contain retained objects.
+ * If SLAB wasn't used for object allocation
+ * (for instance, if you allocated memory using
+ * alloc_slab for the internal needs of your algorithm),
+ * then it is not necessarily to release it.
+ * With an idle timeout the SLABs wait on the idle lists
+ * instead, see cache_set_idle_timeout
+ **/
+void cache_shrink(struct cache *cache)
+{
+#ifdef SLAB_TRACE
+    if (trace_active.load(std::memory_order_relaxed)) {
+        trace_cache(cache, trace_shrink);
+    }
+#endif
+
+    if (cache->flags & SLAB_CONCURRENT) {
+        shrink_concurrent(cache, SIZE_MAX, 0);
+        return;
+    }
+
+    // magazines of running threads are theirs, only the depot and the other ones are drained
+    flush_magazines(cache);
+
+    std::lock_guard<std::mutex> guard(cache->lock);
+    collect_remote_frees(cache);
+    expire_idle_slabs(cache, SIZE_MAX, cache->idle_timeout);
+    for (auto &node : cache->nodes) {
+        while (auto slab = node.complete_slab) {
+            remove_from_complete_list(&node, slab);
+            shrink_slab(cache, slab);
+        }
+        node.complete_low = 0;
+    }
+}
+
+/**
+ * Whether SLABs of the cache hold objects, allocated or cached
+ * by magazines and per-CPU stacks. cache->lock must be held
+ **/
+bool slabs_in_use(struct cache *cache) {
+    for (int i = 0; i < numa_node_count(); ++i) {
+        auto node = &cache->nodes[i];
+        if (node->partially_count || node->empty_count || node->slab_count) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Sets the rounds of magazines and per-CPU stacks, 0 turns
+ * both off. cache->lock must be held and no SLAB in use
+ **/
+void set_magazine_size(struct cache *cache, size_t rounds) {
+    cache->magazine_size = std::min(rounds, max_magazine_size);
+
+#ifdef SLAB_USE_RSEQ
+    if (!cache->magazine_size) {
+        free(cache->cpu_stacks);
+        cache->cpu_stacks = nullptr;
+        cache->cpu_count = 0;
+    }
+#endif
+}
+
+/**
+ * Sets the count of objects one magazine holds, up to
+ * max_magazine_size, 0 makes every cache_alloc and cache_free
+ * go to the SLABs. The per-CPU stacks of a cache set up with
+ * them take as many objects. Returns false and leaves the
+ * cache alone once it holds objects
+ **/
+bool cache_set_magazine_size(struct cache *cache, size_t rounds)
+{
+    std::lock_guard<std::mutex> guard(cache->lock);
+    if (slabs_in_use(cache)) {
+        return false;
+    }
+    set_magazine_size(cache, rounds);
+    return true;
+}
+
+/**
+ * Releases no more than `max_slabs` free SLABs, so a reclaim
+ * is spread over many calls instead of one long pause. Only
+ * SLABs which stayed free since the previous call and exceed
+ * free_slabs_kept per node are candidates, half of them go
+ * each call: free SLABs of a burst decay over a few calls
+ * instead of going back and forth to the arena. The SLABs
+ * free for the longest, at the list tails, go first.
+ * Magazines aren't flushed, unlike cache_shrink.
+ * SLAB_CONCURRENT caches have no watermark, their free
+ * SLABs on the stacks beyond free_slabs_kept go at once.
+ * Idle SLABs past the idle timeout are freed within the budget.
+ * Returns the count of released SLABs
+ **/
+size_t cache_shrink_budget(struct cache *cache, size_t max_slabs)
+{
+    if (cache->flags & SLAB_CONCURRENT) {
+        return shrink_concurrent(cache, max_slabs, cache->free_slabs_kept);
+    }
+
+    size_t released = 0;
+
+    std::lock_guard<std::mutex> guard(cache->lock);
+    collect_remote_frees(cache);
+    for (auto &node : cache->nodes) {
+        size_t idle = node.complete_low > cache->free_slabs_kept ? node.complete_low - cache->free_slabs_kept : 0;
+        size_t count = std::min((idle + 1) / 2, max_slabs - released);
+
+        slabStruct *slab = node.complete_slab;
+        while (count && slab && slab->next) {
+            slab = slab->next;
+        }
+        while (count && slab) {
+            auto previous = slab->previous;
+            remove_from_complete_list(&node, slab);
+            shrink_slab(cache, slab);
+            slab = previous;
+            count -= 1;
+            released += 1;
+        }
+
+        node.complete_low = node.complete_count;
+    }
+
+    return released + expire_idle_slabs(cache, max_slabs - released, cache->idle_timeout);
+}
+
+/**
+ * Sets the count of free SLABs per NUMA node
+ * cache_shrink_budget keeps, cache_shrink releases them all
+ **/
+void cache_set_free_slabs_kept(struct cache *cache, size_t count)
+{
+    std::lock_guard<std::mutex> guard(cache->lock);
+    cache->free_slabs_kept = count;
+}
+
+/**
+ * Sets the milliseconds free SLABs taken by shrinks stay on
+ * the idle lists of the cache before they go back to the arena.
+ * Their pages are given back with MADV_FREE, so a burst after a
+ * shrink reuses them without alloc_slab and syscalls. 0, the
+ * default, frees SLABs at once and the idle ones right away.
+ * cache_shrink and cache_shrink_budget free the expired SLABs
+ **/
+void cache_set_idle_timeout(struct cache *cache, uint64_t timeout_ms)
+{
+    std::lock_guard<std::mutex> guard(cache->lock);
+    cache->idle_timeout = timeout_ms;
+    if (!timeout_ms) {
+        expire_idle_slabs(cache, SIZE_MAX, 0);
+    }
+}
+
+/**
+ * Sets the callback cache_defrag moves live objects with, like
+ * movable objects of Linux SLUB. `migrate` must copy the object
+ * at `from` to `to` and redirect all references to it, or return
+ * false if it can't, e.g. for an object it already freed. With a
+ * ctor `from` must be left constructed. Objects held by magazines
+ * would look live, so the cache goes without them: the function
+ * must be called after setup before the first cache_alloc.
+ * Returns false and leaves the cache alone once it holds objects
+ **/
+bool cache_set_migrate(struct cache *cache, bool (*migrate)(void *from, void *to))
+{
+    std::lock_guard<std::mutex> guard(cache->lock);
+    if (slabs_in_use(cache)) {
+        return false;
+    }
+
+    cache->migrate = migrate;
+    set_magazine_size(cache, 0);
+    return true;
+}
+
+/**
+ * Evacuates up to `max_slabs` of the sparsest SLABs, under
+ * 1/4 of objects used, by moving their objects with the
+ * migrate callback into the fullest SLABs of the same node,
+ * as long as the other partially occupied SLABs have room. The
+ * SLABs are taken off the lists while the callback runs
+ * without cache->lock, so it may use the cache itself.
+ * Emptied SLABs wait on the complete lists for cache_shrink.
+ * Returns the count of emptied SLABs
+ **/
+size_t cache_defrag(struct cache *cache, size_t max_slabs)
+{
+    if (!cache->migrate) {
+        return 0;
+    }
+
+    std::vector<slabStruct*> isolated;
+    {
+        std::lock_guard<std::mutex> guard(cache->lock);
+        collect_remote_frees(cache);
+        for (auto &node : cache->nodes) {
+            size_t room = 0;
+            std::vector<slabStruct*> sparse;
+            for (unsigned bin = 0; bin < partial_bin_count; ++bin) {
+                for (auto slab = node.partially_slabs[bin]; slab; slab = slab->next) {
+                    room += cache->slab_objects - slab->refcnt;
+                    if (bin < defrag_bin_count) {
+                        sparse.push_back(slab);
+                    }
+                }
+            }
+
+            // the sparsest SLABs go while the SLABs left have room for their objects
+            std::sort(sparse.begin(), sparse.end(), [](slabStruct *a, slabStruct *b) {
+                return a->refcnt < b->refcnt;
+            });
+            for (auto slab : sparse) {
+                if (isolated.size() >= max_slabs || room < cache->slab_objects) {
+                    break;
+                }
+                room -= cache->slab_objects;
+                remove_from_partially_list(&node, slab);
+                slab->isolated = true;
+                isolated.push_back(slab);
+            }
+        }
+    }
+
+    std::vector<bool> used;
+    for (auto slab : isolated) {
+        auto node = &cache->nodes[slab->node];
+        {
+            std::lock_guard<std::mutex> guard(cache->lock);
+            used.assign(cache->slab_objects, true);
+            for (auto object = slab->free_object; object; object = get_free_pointer(cache, object)) {
+                used[slot_index(cache, slab, object)] = false;
+            }
+            for (size_t i = 0; i < cache->bitmap_words * 64 && i < cache->slab_objects; ++i) {
+                if (slab->bitmap[i / 64] & ((uint64_t)1 << (i % 64))) {
+                    used[i] = false;
+                }
+            }
+        }
+
+        for (size_t i = 0; i < cache->slab_objects; ++i) {
+            if (!used[i]) {
+                continue;
+            }
+
+            void *from = slab->objects + cache->object_size * i;
+            void *to;
+            {
+                std::lock_guard<std::mutex> guard(cache->lock);
+                auto target = fullest_partially_slab(node);
+                if (!target) {
+                    break;
+                }
+
+                to = pop_free_object(cache, target);
+                if (target->refcnt == cache->slab_objects) {
+                    remove_from_partially_list(node, target);
+                    insert_in_empty_list(node, target);
+                } else {
+                    update_partially_list(cache, node, target);
+                }
+            }
+
+            void *freed = cache->migrate(from, to) ? from : to;
+            if (cache->debug_size) {
+                if (freed == from) {
+                    debug_alloc_object(cache, to);
+                }
+                debug_free_object(cache, freed);
+            }
+
+            std::lock_guard<std::mutex> guard(cache->lock);
+            slab_free_object(cache, freed);
+        }
+    }
+
+    size_t emptied = 0;
+    std::lock_guard<std::mutex> guard(cache->lock);
+    collect_remote_frees(cache);
+    for (auto slab : isolated) {
+        auto node = &cache->nodes[slab->node];
+        slab->isolated = false;
+        if (slab->refcnt == 0) {
+            insert_in_complete_list(node, slab);
+            emptied += 1;
+        } else if (slab->refcnt == cache->slab_objects) {
+            insert_in_empty_list(node, slab);
+        } else {
+            insert_in_partially_list(cache, node, slab);
+        }
+    }
+
+    return emptied;
+}
+
+/**
+ * Fills `stats` with the counters of the cache. Without
+ * SLAB_STATS only the SLAB lists are counted, the
+ * counters of allocations and their derivatives are 0
+ **/
+void cache_stats(struct cache *cache, cache_statistics *stats)
+{
+    std::lock_guard<std::mutex> guard(cache->lock);
+
+    *stats = cache_statistics();
+    stats->object_size = cache->object_size;
+    stats->slot_size = cache->object_size;
+    stats->slab_size = (size_t)4096 << cache->slab_order;
+    stats->slab_objects = cache->slab_objects;
+    stats->magazine_size = cache->magazine_size;
+    stats->corruptions = cache->corruptions.load(std::memory_order_relaxed);
+
+    for (auto &node : cache->nodes) {
+        stats->full_slabs += node.empty_count;
+        stats->partial_slabs += node.partially_count;
+        stats->free_slabs += node.complete_count;
+        // SLABs of SLAB_CONCURRENT caches change hands without the lock, they all count as partial
+        stats->partial_slabs += node.slab_count;
+        stats->idle_slabs += node.idle_count;
+    }
+    size_t slabs = stats->full_slabs + stats->partial_slabs + stats->free_slabs;
+    stats->total_objects = slabs * cache->slab_objects;
+    stats->wasted_bytes = slabs * (stats->slab_size - cache->slab_objects * cache->object_size);
+
+#ifdef SLAB_STATS
+    stats->object_size = cache->requested_size;
+    stats->allocs = cache->shared_allocs.load(std::memory_order_relaxed);
+    stats->frees = cache->shared_frees.load(std::memory_order_relaxed);
+    for (auto &slot : cache->thread_stats) {
+        if (auto thread = slot.load(std::memory_order_acquire)) {
+            stats->allocs += thread->allocs.load(std::memory_order_relaxed);
+            stats->frees += thread->frees.load(std::memory_order_relaxed);
+        }
+    }
+
+    // counters of different threads are read at different moments
+    stats->active_objects = stats->allocs > stats->frees ? stats->allocs - stats->frees : 0;
+    stats->wasted_bytes += stats->active_objects * (cache->object_size - cache->requested_size);
+    stats->slab_allocs = cache->slab_allocs;
+    stats->slab_frees = cache->slab_frees;
+    stats->peak_bytes = cache->peak_slabs * stats->slab_size;
+#endif
+}
+
+/**
+ * Writes a line of cache_stats of every set up cache
+ * to `out`, in the spirit of /proc/slabinfo
+ **/
+void slab_stats_dump(FILE *out)
+{
+    fprintf(out, "# cache : <objsize> <slotsize> <objperslab> <pagesperslab> <magazine>"
+                 " : <active_objs> <num_objs> <allocs> <frees>"
+                 " : slabdata <full> <partial> <free> <slab_allocs> <slab_frees>"
+                 " : memory <wasted> <peak>\n");
+
+    std::lock_guard<std::mutex> guard(cache_registry_lock);
+    for (auto cache = cache_registry; cache; cache = cache->registry_next) {
+        cache_statistics stats;
+        cache_stats(cache, &stats);
+        fprintf(out, "%p : %zu %zu %zu %zu %zu : %zu %zu %llu %llu : slabdata %zu %zu %zu %llu %llu : memory %zu %zu\n",
+                (void*)cache, stats.object_size, stats.slot_size, stats.slab_objects, stats.slab_size / 4096,
+                stats.magazine_size, stats.active_objects, stats.total_objects,
+                (unsigned long long)stats.allocs, (unsigned long long)stats.frees,
+                stats.full_slabs, stats.partial_slabs, stats.free_slabs,
+                (unsigned long long)stats.slab_allocs, (unsigned long long)stats.slab_frees,
+                stats.wasted_bytes, stats.peak_bytes);
+    }
+}
+
+#ifdef SLAB_TRACE
+/**
+ * Starts writing allocations, frees, shrinks and releases of
+ * all caches to the file at `path` as trace_record entries
+ * after trace_magic, slab_replay replays them. Returns false
+ * if a trace is written already or the file can't be created
+ **/
+bool slab_trace_start(const char *path)
+{
+    auto &state = get_trace();
+    std::lock_guard<std::mutex> guard(state.lock);
+    if (state.file) {
+        return false;
+    }
+
+    state.file = fopen(path, "wb");
+    if (!state.file) {
+        return false;
+    }
+    setvbuf(state.file, nullptr, _IOFBF, 1 << 20);
+    fwrite(trace_magic, sizeof(trace_magic), 1, state.file);
+
+    state.start = std::chrono::steady_clock::now();
+    state.caches.clear();
+    state.next_cache = 0;
+    state.objects.clear();
+    state.free_ids.clear();
+    state.next_object = 0;
+    trace_active.store(true, std::memory_order_relaxed);
+    return true;
+}
+
+/**
+ * Stops the trace of slab_trace_start and closes its file
+ **/
+void slab_trace_stop()
+{
+    auto &state = get_trace();
+    std::lock_guard<std::mutex> guard(state.lock);
+    trace_active.store(false, std::memory_order_relaxed);
+    if (state.file) {
+        fclose(state.file);
+        state.file = nullptr;
+    }
+}
+#endif
+
+const size_t size_class_count = 57;
+
+/**
+ * Caches of slab_malloc. Sizes step by 16 bytes up to 128 and
+ * by 1/8 of the power of two below them further on, so no
+ * more than 12.5% of an object is lost to rounding. Lookup
+ * tables map a size to its class in constant time: one with
+ * 8 byte steps up to 1024 bytes and one with 128 byte steps
+ **/
+struct size_classes {
+    struct cache caches[size_class_count];
+    uint8_t small_index[1024 / 8 + 1];
+    uint8_t large_index[max_size_class / 128 + 1];
+
+    size_classes() {
+        size_t sizes[size_class_count];
+        size_t count = 0;
+
+        sizes[count++] = 8;
+        for (size_t size = 16; size <= 128; size += 16) {
+            sizes[count++] = size;
+        }
+        for (size_t base = 128; base < max_size_class; base <<= 1) {
+            for (size_t size = base + base / 8; size <= 2 * base; size += base / 8) {
+                sizes[count++] = size;
+            }
+        }
+
+        // objects are aligned on the largest power of two dividing their size, 16 and more past 8 bytes,
+        // up to a cache line, those of a power of two size on the size up to a page for over-aligned
+        // requests: their SLABs hold as many objects either way
+        for (size_t i = 0; i < count; ++i) {
+            size_t align = sizes[i] & (0 - sizes[i]);
+            if (align != sizes[i]) {
+                align = std::min(align, cache_line_size);
+            }
+            cache_setup_ex(&caches[i], sizes[i], align, 0, nullptr, nullptr);
+        }
+
+        size_t index = 0;
+        for (size_t i = 0; i < sizeof(small_index); ++i) {
+            while (sizes[index] < i * 8) {
+                index += 1;
+            }
+            small_index[i] = (uint8_t)index;
+        }
+        for (size_t i = 0; i < sizeof(large_index); ++i) {
+            while (sizes[index] < i * 128) {
+                index += 1;
+            }
+            large_index[i] = (uint8_t)index;
+        }
+    }
+};
+
+size_classes &get_size_classes() {
+    static size_classes classes;
+    return classes;
+}
+
+/**
+ * The function of allocation of `size` bytes from the size
+ * class caches. Requests over max_size_class take a whole
+ * SLAB of their own. Returns nullptr for sizes over 4Mb
+ * or when the memory is over
+ **/
+void *slab_malloc(size_t size)
+{
+    auto &classes = get_size_classes();
+
+    if (size <= 1024) {
+        return cache_alloc(&classes.caches[classes.small_index[(size + 7) >> 3]]);
+    }
+    if (size <= max_size_class) {
+        return cache_alloc(&classes.caches[classes.large_index[(size + 127) >> 7]]);
+    }
+
+    int order = 0;
+    while (order <= max_slab_order && ((size_t)4096 << order) < size) {
+        order += 1;
+    }
+    if (order > max_slab_order) {
+        return nullptr;
+    }
+
+    // a SLAB of one object without a cache, its slabStruct lives off it for the page map
+    auto memory = (uint8_t*)alloc_slab(order);
+    if (!memory) {
+        return nullptr;
+    }
+    auto slab = new slabStruct();
+    slab->cache = nullptr;
+    slab->objects = memory;
+    map_slab(memory, (size_t)4096 << order, slab);
+    return memory;
+}
+
+/**
+ * The function of freeing memory returned by slab_malloc or
+ * by cache_alloc of any cache, the cache is found in the
+ * slabStruct the page map gives for the pointer. Pointers
+ * not allocated from SLABs are ignored
+ **/
+void slab_free(void *ptr)
+{
+    auto slab = ptr ? slab_lookup(ptr) : nullptr;
+    if (!slab) {
+        return;
+    }
+
+    if (slab->cache) {
+        cache_free_to_slab(slab->cache, slab, ptr);
+    } else {
+        map_slab(slab->objects, arena_block_size(arena_of(slab->objects), slab->objects), nullptr);
+        free_slab(slab->objects);
+        delete slab;
+    }
+}
+
+/**
+ * Bytes usable at a pointer of slab_malloc or cache_alloc,
+ * at least the requested size. Returns 0 for pointers not
+ * allocated from SLABs
+ **/
+size_t slab_usable_size(void *ptr)
+{
+    auto slab = ptr ? slab_lookup(ptr) : nullptr;
+    if (!slab) {
+        return 0;
+    }
+
+    if (!slab->cache) {
+        return arena_block_size(arena_of(slab->objects), slab->objects);
+    }
+    if (slab->cache->debug_size) {
+        return slab->cache->debug_size;
+    }
+    // the free pointer of caches with a constructor follows the object
+    return slab->cache->free_offset ? slab->cache->free_offset : slab->cache->object_size;
+}
+
+/* memory.events of the cgroup v2 hierarchy, the cgroup of the process is appended */
+const char *const cgroup_root = "/sys/fs/cgroup";
+
+/* PSI share of time some tasks stalled on memory during the last 10 seconds, in percents, making the reclaim full */
+const double memory_pressure_threshold = 1.0;
+
+/**
+ * The reclaimer thread, see slab_reclaimer_start
+ **/
+struct reclaimer {
+    std::mutex lock;
+    std::condition_variable wakeup;
+    std::thread thread;
+    bool running;
+
+    std::chrono::milliseconds interval;
+    size_t max_slabs; /* cache_shrink_budget budget of every cache without memory pressure */
+
+    std::string memory_events; /* path of memory.events of the process cgroup, empty if unknown */
+    uint64_t pressure_events; /* high, max and oom events of memory.events seen so far */
+};
+
+reclaimer &get_reclaimer() {
+    // never destroyed: the thread may still run while static objects are destructed
+    static auto instance = new reclaimer();
+    return *instance;
+}
+
+/**
+ * Path of memory.events of the cgroup v2 the process
+ * belongs to, empty without the unified hierarchy
+ **/
+std::string cgroup_memory_events() {
+    std::string path;
+    if (FILE *cgroup = fopen("/proc/self/cgroup", "r")) {
+        char line[4096];
+        while (fgets(line, sizeof(line), cgroup)) {
+            if (strncmp(line, "0::", 3) == 0) {
+                line[strcspn(line, "\n")] = 0;
+                path = std::string(cgroup_root) + (line + 3) + "/memory.events";
+                break;
+            }
+        }
+        fclose(cgroup);
+    }
+    return access(path.c_str(), R_OK) == 0 ? path : std::string();
+}
+
+/**
+ * Reads a text file of procfs or cgroupfs into `buffer`
+ * as a string, false if it can't be read
+ **/
+bool read_text_file(const char *path, char *buffer, size_t size) {
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        return false;
+    }
+    size_t length = fread(buffer, 1, size - 1, file);
+    buffer[length] = 0;
+    fclose(file);
+    return true;
+}
+
+/**
+ * Share of time some tasks stalled on memory during the last
+ * 10 seconds, in percents, from the text of /proc/pressure/memory.
+ * 0 if the text has no "some" line
+ **/
+double psi_some_avg10(const char *text) {
+    for (const char *line = text; *line;) {
+        double some;
+        if (sscanf(line, "some avg10=%lf", &some) == 1) {
+            return some;
+        }
+        const char *end = strchr(line, '\n');
+        if (!end) {
+            break;
+        }
+        line = end + 1;
+    }
+    return 0;
+}
+
+/**
+ * Sum of the high, max and oom counters in the text of
+ * memory.events, they only grow while the cgroup is short of memory
+ **/
+uint64_t memory_events_pressure(const char *text) {
+    uint64_t events = 0;
+    char name[64];
+    unsigned long long count;
+    int length;
+    while (sscanf(text, "%63s %llu%n", name, &count, &length) == 2) {
+        if (!strcmp(name, "high") || !strcmp(name, "max") || !strcmp(name, "oom")) {
+            events += count;
+        }
+        text += length;
+    }
+    return events;
+}
+
+uint64_t read_pressure_events(const std::string &path) {
+    char text[1024];
+    return read_text_file(path.c_str(), text, sizeof(text)) ? memory_events_pressure(text) : 0;
+}
+
+/**
+ * True if PSI reports memory stalls over memory_pressure_threshold
+ * or the cgroup hit its memory limits since the previous check
+ **/
+bool memory_pressure(reclaimer *state) {
+    bool pressure = false;
+
+    char text[1024];
+    if (read_text_file("/proc/pressure/memory", text, sizeof(text)) &&
+        psi_some_avg10(text) > memory_pressure_threshold) {
+        pressure = true;
+    }
+
+    if (!state->memory_events.empty()) {
+        uint64_t events = read_pressure_events(state->memory_events);
+        if (events != state->pressure_events) {
+            state->pressure_events = events;
+            pressure = true;
+        }
+    }
+
+    return pressure;
+}
+
+/**
+ * One pass of the reclaimer: budgeted shrinks of every cache, full
+ * ones under memory pressure, then the pages of the free blocks of
+ * the arenas are given back without unmapping them. The caches are
+ * pinned under the registry lock and shrunk without it, so setups,
+ * releases and dumps don't wait for the pass, only a release of
+ * the cache being shrunk does
+ **/
+void reclaim(reclaimer *state) {
+    bool pressure = memory_pressure(state);
+
+    std::vector<struct cache*> caches;
+    {
+        std::lock_guard<std::mutex> guard(cache_registry_lock);
+        for (auto cache = cache_registry; cache; cache = cache->registry_next) {
+            cache->reclaim_pins += 1;
+            caches.push_back(cache);
+        }
+    }
+
+    for (auto cache : caches) {
+        std::unique_lock<std::mutex> lock(cache_registry_lock);
+        // released since the snapshot, its release waits for the pin to go
+        if (cache->registered) {
+            lock.unlock();
+            if (pressure) {
+                cache_shrink(cache);
+            } else {
+                cache_shrink_budget(cache, state->max_slabs);
+            }
+            lock.lock();
+        }
+        if (--cache->reclaim_pins == 0) {
+            cache_registry_unpinned.notify_all();
+        }
+    }
+
+    slab_purge();
+}
+
+/**
+ * Starts a thread running cache_shrink_budget over every set up
+ * cache each `interval_ms` milliseconds, with up to `max_slabs`
+ * SLABs released per cache and pass. When Linux PSI or the cgroup
+ * memory.events report memory pressure, caches are shrunk fully.
+ * Pages of free arena blocks go back with madvise(MADV_DONTNEED).
+ * Returns false if the reclaimer is running already
+ **/
+bool slab_reclaimer_start(unsigned interval_ms, size_t max_slabs)
+{
+    auto &state = get_reclaimer();
+
+    std::lock_guard<std::mutex> guard(state.lock);
+    if (state.running) {
+        return false;
+    }
+
+    state.running = true;
+    state.interval = std::chrono::milliseconds(interval_ms);
+    state.max_slabs = max_slabs;
+    state.memory_events = cgroup_memory_events();
+    state.pressure_events = state.memory_events.empty() ? 0 : read_pressure_events(state.memory_events);
+
+    state.thread = std::thread([&state] {
+        std::unique_lock<std::mutex> lock(state.lock);
+        while (!state.wakeup.wait_for(lock, state.interval, [&state] { return !state.running; })) {
+            lock.unlock();
+            reclaim(&state);
+            lock.lock();
+        }
+    });
+    return true;
+}
+
+/**
+ * Stops the thread of slab_reclaimer_start and waits for it
+ **/
+void slab_reclaimer_stop()
+{
+    auto &state = get_reclaimer();
+
+    std::thread thread;
+    {
+        std::lock_guard<std::mutex> guard(state.lock);
+        if (!state.running) {
+            return;
+        }
+        state.running = false;
+        thread.swap(state.thread);
+    }
+
+    state.wakeup.notify_all();
+    thread.join();
+}
+
+/**
+ * Gives the pages of free SLAB memory of the arenas back to the
+ * system, the reclaimer thread does it after every pass.
+ * Returns the count of bytes given back
+ **/
+size_t slab_purge()
+{
+    size_t purged = arena_purge(default_arena());
+    if (auto huge = huge_arena_instance.load(std::memory_order_acquire)) {
+        purged += arena_purge(huge);
+    }
+    return purged;
+}
+
+/* the first bytes of a file of cache_attach */
+const char persistent_magic[8] = {'S', 'L', 'A', 'B', 'P', 'R', 'S', '1'};
+
+/* the most files attached at the same time */
+const size_t max_persistent_files = 8;
+
+/**
+ * The start of a file of cache_attach, mapped at `base`. The page
+ * state and the page map of the arena follow it, the arena starts
+ * at the next max_slab_order block. Pointers in the file are
+ * absolute, the fixed base keeps them valid between processes
+ **/
+struct persistent_layout {
+    char magic[sizeof(persistent_magic)];
+    uint32_t cache_bytes; /* sizeof(struct cache) and sizeof(slabStruct) of the build */
+    uint32_t slab_bytes; /* which wrote the file, other layouts can't attach it */
+    uintptr_t base;
+    size_t size; /* bytes of the file and the mapping */
+    size_t object_size; /* of cache_attach */
+    size_t align;
+    bool clean; /* set by cache_detach, cleared while the file is attached */
+};
+
+struct persistent_header {
+    persistent_layout layout; /* read before the file is mapped */
+    void *root; /* see cache_root */
+    page_arena arena;
+    struct cache cache;
+};
+
+std::mutex persistent_lock; /* serializes cache_attach and cache_detach */
+std::atomic<persistent_header*> persistent_files[max_persistent_files];
+
+/**
+ * Arena of the attached file holding `memory`, nullptr if none does
+ **/
+page_arena *persistent_arena_of(void *memory) {
+    for (auto &file : persistent_files) {
+        auto header = file.load(std::memory_order_acquire);
+        if (header && arena_contains(&header->arena, memory)) {
+            return &header->arena;
+        }
+    }
+    return nullptr;
+}
+
+#ifndef MAP_FIXED_NOREPLACE
+// Linux 4.17, older kernels take the address for a hint and cache_attach checks it
+#define MAP_FIXED_NOREPLACE 0x100000
+#endif
+
+/**
+ * Header of the attached file holding `cache`, nullptr for other caches.
+ * persistent_lock must be held
+ **/
+persistent_header *persistent_file_of(struct cache *cache, size_t *slot) {
+    for (size_t i = 0; i < max_persistent_files; ++i) {
+        auto header = persistent_files[i].load(std::memory_order_relaxed);
+        if (header && &header->cache == cache) {
+            *slot = i;
+            return header;
+        }
+    }
+    return nullptr;
+}
+
+/**
+ * Lays the arena of a new file out: the page state and the
+ * page map follow the header, SLABs take the aligned rest.
+ * Returns false if the file has no room for a 4Mb block
+ **/
+bool persistent_arena_setup(persistent_header *header, size_t size) {
+    size_t block_size = (size_t)4096 << max_slab_order;
+    size_t pages = size / 4096;
+    size_t page_state = (sizeof(persistent_header) + 4095) & ~(size_t)4095;
+    size_t page_slabs = (page_state + pages + alignof(slabStruct*) - 1) & ~(alignof(slabStruct*) - 1);
+    size_t start = (page_slabs + pages * sizeof(slabStruct*) + block_size - 1) & ~(block_size - 1);
+    if (start + block_size > size) {
+        return false;
+    }
+
+    auto base = (uint8_t*)header;
+    auto arena = new (&header->arena) page_arena();
+    arena->start = base + start;
+    arena->size = (size - start) & ~(block_size - 1);
+    arena->used = 0;
+    for (auto &list : arena->free_blocks) {
+        list = nullptr;
+    }
+    // the file is sparse and reads as zeros: no block has a state and no page a SLAB yet
+    arena->page_state = base + page_state;
+    arena->page_slabs = (slabStruct**)(base + page_slabs);
+    arena->hugetlb = false;
+    // pages of files come from the page cache, memory policies don't place them
+    arena->block_nodes = nullptr;
+    arena->page_size = 4096;
+    return true;
+}
+
+/**
+ * Constructs again what the process which wrote the file kept
+ * outside of it: locks, magazines, counters of its threads, the
+ * links of the reclaimer registry and the owners of used SLABs
+ **/
+void revive_persistent_cache(persistent_header *header) {
+    new (&header->arena.lock) std::mutex();
+
+    auto cache = &header->cache;
+    new (&cache->lock) std::mutex();
+    new (&cache->depot_lock) std::mutex();
+    cache->ctor = nullptr;
+    cache->dtor = nullptr;
+    cache->migrate = nullptr;
+    for (auto &magazines : cache->magazines) {
+        magazines.store(nullptr, std::memory_order_relaxed);
+    }
+    cache->full_magazines = nullptr;
+    cache->empty_magazines = nullptr;
+    cache->full_magazines_count = 0;
+#ifdef SLAB_USE_RSEQ
+    cache->cpu_stacks = nullptr;
+    cache->cpu_count = 0;
+#endif
+#ifdef SLAB_STATS
+    for (auto &stats : cache->thread_stats) {
+        stats.store(nullptr, std::memory_order_relaxed);
+    }
+#endif
+    // owners are thread indexes of the process which wrote the file, frees of the attaching thread stay local
+    int thread = current_thread_index();
+    for (auto &node : cache->nodes) {
+        for (auto slab : node.partially_slabs) {
+            for (; slab; slab = slab->next) {
+                slab->owner.store(thread, std::memory_order_relaxed);
+            }
+        }
+        for (auto slab = node.empty_slab; slab; slab = slab->next) {
+            slab->owner.store(thread, std::memory_order_relaxed);
+        }
+    }
+    cache->registered = false;
+    register_cache(cache);
+}
+
+/**
+ * Opens a cache whose SLABs, slabStructs and lists live in the file
+ * at `path`, mapped with MAP_SHARED at the fixed address `base`, so
+ * objects and pointers between them survive the process. A new file
+ * of `size` bytes is created when there is none, `base` must be
+ * aligned on 4Mb. An existing file is mapped at the base and with
+ * the size it was created with, its objects come back as they were
+ * at cache_detach. Objects are `object_size` bytes aligned on
+ * `align`, like cache_setup_ex, and must match the file.
+ * Returns nullptr if the file can't be mapped at its base, was
+ * written by a different build or not detached, e.g. after a crash:
+ * its lists may be inconsistent and the caller starts over
+ **/
+struct cache *cache_attach(const char *path, size_t object_size, size_t align, void *base, size_t size)
+{
+    std::lock_guard<std::mutex> guard(persistent_lock);
+
+    size_t slot = 0;
+    while (slot < max_persistent_files && persistent_files[slot].load(std::memory_order_relaxed)) {
+        slot += 1;
+    }
+    if (slot == max_persistent_files) {
+        return nullptr;
+    }
+
+    int fd = open(path, O_RDWR | O_CREAT | O_EXCL, 0600);
+    bool created = fd >= 0;
+    if (!created) {
+        fd = open(path, O_RDWR);
+    }
+    struct stat status;
+    if (fd < 0 || fstat(fd, &status) != 0) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        return nullptr;
+    }
+
+    bool existing = status.st_size > 0;
+    bool valid;
+    if (existing) {
+        persistent_layout layout;
+        valid = pread(fd, &layout, sizeof(layout), 0) == (ssize_t)sizeof(layout) &&
+                memcmp(layout.magic, persistent_magic, sizeof(persistent_magic)) == 0 &&
+                layout.cache_bytes == sizeof(struct cache) && layout.slab_bytes == sizeof(slabStruct) &&
+                layout.size == (size_t)status.st_size && layout.object_size == object_size &&
+                layout.align == align && layout.clean;
+        base = (void*)layout.base;
+        size = layout.size;
+    } else {
+        valid = (uintptr_t)base % ((size_t)4096 << max_slab_order) == 0 && ftruncate(fd, (off_t)size) == 0;
+    }
+
+    void *memory = MAP_FAILED;
+    if (valid) {
+        memory = mmap(base, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED_NOREPLACE, fd, 0);
+        if (memory != MAP_FAILED && memory != base) {
+            munmap(memory, size);
+            memory = MAP_FAILED;
+        }
+    }
+    close(fd);
+
+    auto header = (persistent_header*)memory;
+    if (memory != MAP_FAILED && !existing && !persistent_arena_setup(header, size)) {
+        munmap(memory, size);
+        memory = MAP_FAILED;
+    }
+    if (memory == MAP_FAILED) {
+        if (created) {
+            unlink(path);
+        }
+        return nullptr;
+    }
+
+    // free_slab finds the arena before the reclaimer can shrink the cache
+    persistent_files[slot].store(header, std::memory_order_release);
+    if (existing) {
+        revive_persistent_cache(header);
+    } else {
+        memcpy(header->layout.magic, persistent_magic, sizeof(persistent_magic));
+        header->layout.cache_bytes = sizeof(struct cache);
+        header->layout.slab_bytes = sizeof(slabStruct);
+        header->layout.base = (uintptr_t)base;
+        header->layout.size = size;
+        header->layout.object_size = object_size;
+        header->layout.align = align;
+        header->root = nullptr;
+
+        auto cache = new (&header->cache) struct cache();
+        cache->arena = &header->arena;
+        cache_setup_ex(cache, object_size, align, SLAB_PERSISTENT, nullptr, nullptr);
+    }
+    header->layout.clean = false;
+    return &header->cache;
+}
+
+/**
+ * Writes an attached cache back to its file and unmaps it, the
+ * next cache_attach of the file finds its objects. No thread may
+ * use the cache or its objects any more, cache_release instead
+ * frees all objects and keeps the file attached
+ **/
+void cache_detach(struct cache *cache)
+{
+    std::lock_guard<std::mutex> guard(persistent_lock);
+
+    size_t slot;
+    auto header = persistent_file_of(cache, &slot);
+    if (!header) {
+        return;
+    }
+
+    unregister_cache(cache);
+    {
+        std::lock_guard<std::mutex> lock(cache->lock);
+        collect_remote_frees(cache);
+    }
+#ifdef SLAB_STATS
+    // counters of the threads of this process go to the file
+    for (auto &slot_stats : cache->thread_stats) {
+        if (auto stats = slot_stats.exchange(nullptr)) {
+            cache->shared_allocs.fetch_add(stats->allocs.load(std::memory_order_relaxed));
+            cache->shared_frees.fetch_add(stats->frees.load(std::memory_order_relaxed));
+            free(stats);
+        }
+    }
+#endif
+
+    // the file is marked clean only once everything else reached it
+    size_t size = header->layout.size;
+    msync(header, size, MS_SYNC);
+    header->layout.clean = true;
+    msync(header, 4096, MS_SYNC);
+
+    persistent_files[slot].store(nullptr, std::memory_order_release);
+    munmap(header, size);
+}
+
+/**
+ * Slot of the file of an attached cache for a pointer the
+ * application finds its objects from after cache_attach, like
+ * the root of an index. nullptr for caches of cache_setup
+ **/
+void **cache_root(struct cache *cache)
+{
+    std::lock_guard<std::mutex> guard(persistent_lock);
+    size_t slot;
+    auto header = persistent_file_of(cache, &slot);
+    return header ? &header->root : nullptr;
+}
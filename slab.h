@@ -0,0 +1,329 @@
+#ifndef SLAB_ALLOCATOR_SLAB_H
+#define SLAB_ALLOCATOR_SLAB_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+
+struct page_arena;
+
+/* the largest order of blocks of the buddy allocator, 4Mb */
+const int max_slab_order = 10;
+
+/* the largest share of a SLAB cache_setup accepts to leave unused, in percents */
+const size_t max_slab_waste = 12;
+
+
+struct cache;
+
+struct slabStruct {
+    slabStruct *previous;
+    slabStruct *next;
+    struct cache *cache; /* cache the SLAB belongs to */
+
+    uint8_t *objects; /* address of the first object */
+    void *free_object; /* head of the intrusive list of free objects */
+    uint64_t *bitmap; /* SLAB_BITMAP: bit i is set while object i is free, follows the slabStruct */
+    size_t bitmap_hint; /* SLAB_BITMAP: the bitmap words before this one have no free bits */
+    uint32_t refcnt;
+    int node; /* NUMA node of the SLAB memory, index in cache->nodes */
+    unsigned bin; /* index of the partially_slabs list holding the SLAB */
+    bool isolated; /* taken off the lists by cache_defrag */
+
+    std::atomic<int> owner; /* index of the thread which took the SLAB into use */
+    std::atomic<void*> remote_free; /* objects freed by other threads, not counted in refcnt yet */
+    slabStruct *remote_next; /* link in cache->remote_slabs */
+    std::atomic<slabStruct*> stack_next; /* link in cache_node::slab_stack of SLAB_CONCURRENT caches */
+    uint64_t idle_since; /* steady clock milliseconds of the move to cache_node::idle_slab */
+};
+
+/* the largest count of objects (rounds) one magazine can hold */
+const size_t max_magazine_size = 64;
+
+/* full magazines kept by the depot before the next ones are drained back into SLABs */
+const size_t depot_full_limit = 16;
+
+/* the most threads owning their magazines at the same time, the others use SLABs directly */
+const size_t max_magazine_threads = 256;
+
+/**
+ * Magazine of Bonwick's magazine layer: a stack of
+ * free objects owned by one thread at a time
+ **/
+struct magazine {
+    magazine *next; /* link in the depot lists */
+    size_t rounds; /* count of objects in the magazine */
+    void *objects[max_magazine_size];
+};
+
+/**
+ * Magazines of one thread for one cache. Objects are taken from
+ * and returned to `loaded`, `previous` is kept full or empty to
+ * absorb alloc/free ping-pong without visiting the depot
+ **/
+struct alignas(64) thread_magazines {
+    magazine *loaded;
+    magazine *previous;
+};
+
+#ifdef SLAB_USE_RSEQ
+/**
+ * Object stack of one CPU, changed only inside rseq
+ * critical sections running on that CPU
+ **/
+struct alignas(64) cpu_stack {
+    size_t count;
+    void *objects[max_magazine_size];
+};
+#endif
+
+#ifdef SLAB_STATS
+/**
+ * Counters of one thread for one cache, changed only by
+ * that thread with relaxed stores and summed by cache_stats
+ **/
+struct alignas(64) cache_thread_stats {
+    std::atomic<uint64_t> allocs;
+    std::atomic<uint64_t> frees;
+};
+#endif
+
+/* the most NUMA nodes with SLAB lists of their own, the further ones share them */
+const int max_numa_nodes = 8;
+
+/* partially occupied SLABs are kept in this many lists by their share of used objects */
+const unsigned partial_bin_count = 8;
+
+/**
+ * SLAB lists of one NUMA node, like kmem_cache_node of Linux
+ **/
+struct cache_node {
+    slabStruct *complete_slab; /* list of free slabs to support chache_shrink */
+    slabStruct *partially_slabs[partial_bin_count]; /* partially occupied SLABs by occupancy, the fullest last */
+    unsigned partially_mask; /* bit i is set when partially_slabs[i] isn't empty */
+    slabStruct *empty_slab; /* list of fully occupied SLABs */
+
+    size_t complete_count; /* length of complete_slab list */
+    size_t partially_count; /* length of all partially_slabs lists */
+    size_t empty_count; /* length of empty_slab list */
+
+    size_t complete_low; /* the shortest complete_slab list since the last cache_shrink_budget */
+    slabStruct *cursor; /* SLAB of the last allocation, tried before the lists while it is partial */
+
+    std::atomic<uint64_t> slab_stack; /* SLAB_CONCURRENT: tagged head of the stack of SLABs with free objects */
+    slabStruct *slabs; /* SLAB_CONCURRENT: every SLAB of the node, the lists above stay empty */
+    size_t slab_count; /* length of slabs list */
+
+    slabStruct *idle_slab; /* shrunk SLABs waiting for reuse or cache->idle_timeout, the latest first */
+    size_t idle_count; /* length of idle_slab list */
+};
+
+/**
+ * This structure presents an allocator,
+ * you can change it as you like.
+ * The fields and comments in it just give you
+ * a general idea that you might need
+ * to store in this structure.
+ **/
+struct cache {
+    cache_node nodes[max_numa_nodes]; /* SLAB lists of every NUMA node */
+
+    size_t object_size; /* size of allocating object */
+    int slab_order; /* using size of SLAB */
+    size_t slab_objects; /* count of objects in one SLAB */
+
+    unsigned flags; /* SLAB_* flags of cache_setup_ex */
+    size_t align; /* alignment of objects, a power of two */
+    size_t requested_size; /* object_size given to the setup */
+    size_t requested_align; /* align given to the setup */
+    size_t free_offset; /* offset of the free list pointer in a free object */
+    size_t bitmap_words; /* SLAB_BITMAP: 64-bit words of the bitmap of a SLAB, 0 for free lists */
+    size_t debug_size; /* SLAB_RED_ZONE, SLAB_POISON: bytes of an object the application uses, 0 without checks */
+    size_t red_zone_offset; /* SLAB_RED_ZONE: the redzone spans from debug_size to 8 bytes past this offset */
+    std::atomic<uint64_t> corruptions; /* errors the checks of the cache found */
+#ifdef SLAB_FREELIST_HARDENED
+    uintptr_t freelist_random; /* secret free pointers are mixed with */
+#endif
+    void (*ctor)(void *); /* constructs objects of a new SLAB */
+    void (*dtor)(void *); /* destructs objects of a SLAB being freed */
+    bool (*migrate)(void *, void *); /* moves a live object for cache_defrag, see cache_set_migrate */
+    page_arena *arena; /* source of SLAB memory */
+    size_t free_slabs_kept; /* free SLABs per node cache_shrink_budget keeps for bursts */
+    uint64_t idle_timeout; /* milliseconds shrunk SLABs stay idle before free_slab, 0 frees them at once */
+
+    bool registered; /* linked in the registry of the reclaimer thread */
+    unsigned reclaim_pins; /* passes of the reclaimer thread about to shrink the cache, under the registry lock */
+    struct cache *registry_previous;
+    struct cache *registry_next;
+
+    bool off_slab; /* slabStruct lives outside of the SLAB memory */
+    size_t colour_next; /* cache lines the objects of the next SLAB are shifted by */
+
+    std::mutex lock; /* protects SLAB lists and SLABs */
+    std::atomic<slabStruct*> remote_slabs; /* SLABs with non-empty remote_free lists */
+
+    std::atomic<slabStruct*> thread_slabs[max_magazine_threads]; /* SLAB_CONCURRENT: SLAB of each thread index */
+
+    size_t magazine_size; /* rounds in one magazine, 0 disables magazines */
+    std::atomic<thread_magazines*> magazines[max_magazine_threads]; /* indexed by current_thread_index */
+
+    std::mutex depot_lock; /* protects the depot lists */
+    magazine *full_magazines; /* depot list of full magazines */
+    magazine *empty_magazines; /* depot list of empty magazines */
+    size_t full_magazines_count; /* length of full_magazines list */
+
+#ifdef SLAB_USE_RSEQ
+    cpu_stack *cpu_stacks; /* indexed by CPU, nullptr if rseq isn't registered */
+    size_t cpu_count; /* length of cpu_stacks */
+#endif
+
+#ifdef SLAB_STATS
+    std::atomic<cache_thread_stats*> thread_stats[max_magazine_threads]; /* indexed by current_thread_index */
+    // not a cache_thread_stats, its alignas would over-align the cache for new
+    std::atomic<uint64_t> shared_allocs; /* allocations of threads without an index */
+    std::atomic<uint64_t> shared_frees; /* frees of threads without an index */
+    uint64_t slab_allocs; /* SLABs taken from the arena, under the lock */
+    uint64_t slab_frees; /* SLABs given back to the arena, under the lock */
+    size_t peak_slabs; /* the most SLABs held at once */
+#endif
+};
+
+/**
+ * Counters of a cache filled by cache_stats
+ **/
+struct cache_statistics {
+    size_t object_size; /* size given to the setup */
+    size_t slot_size; /* object size with its alignment and free pointer */
+    size_t slab_size; /* bytes of one SLAB */
+    size_t slab_objects; /* objects of one SLAB */
+    size_t magazine_size; /* rounds of one magazine, 0 without magazines */
+
+    uint64_t allocs; /* objects allocated so far */
+    uint64_t frees; /* objects freed so far */
+    uint64_t slab_allocs; /* SLABs taken from alloc_slab so far */
+    uint64_t slab_frees; /* SLABs given back with free_slab so far */
+
+    size_t full_slabs; /* SLABs without free objects */
+    size_t partial_slabs; /* SLABs with used and free objects */
+    size_t free_slabs; /* SLABs without used objects */
+    size_t idle_slabs; /* shrunk SLABs kept for reuse, their pages given back */
+
+    size_t active_objects; /* allocated and not freed objects */
+    size_t total_objects; /* objects of all SLABs */
+    size_t wasted_bytes; /* SLAB bytes no object uses and padding of active objects */
+    size_t peak_bytes; /* the most SLAB memory held at once */
+    uint64_t corruptions; /* double frees, foreign pointers and damaged memory found so far */
+};
+
+/* cache_setup_ex flag: take SLABs from 2Mb huge pages to spare TLB entries */
+const unsigned SLAB_HUGEPAGE = 0x1;
+
+/* cache_setup_ex flag: align objects on cache lines, or on its fraction for small objects */
+const unsigned SLAB_HWCACHE_ALIGN = 0x2;
+
+/* cache_setup_ex flag: for caches shared by many threads, SLABs pass between threads through lock-free stacks,
+ * dropped when the arena lies past the 48 bit addresses the stack heads keep */
+const unsigned SLAB_CONCURRENT = 0x4;
+
+/* cache_setup_ex flag: free objects are tracked by a bitmap in the SLAB instead of an intrusive list, without magazines */
+const unsigned SLAB_BITMAP = 0x8;
+
+/* cache_setup_ex flag: a guarded gap follows every object, frees check it and catch double and foreign frees */
+const unsigned SLAB_RED_ZONE = 0x10;
+
+/* cache_setup_ex flag: free objects are filled with a pattern, allocations check it for writes after free */
+const unsigned SLAB_POISON = 0x20;
+
+/* flag of caches of cache_attach: SLABs and lists live in a file mapped at a fixed address */
+const unsigned SLAB_PERSISTENT = 0x40;
+
+/* objects of SLABs are shifted by multiples of it, so equal objects of different SLABs hit different cache sets */
+const size_t cache_line_size = 64;
+
+/* operations of trace_record */
+const uint8_t trace_setup = 1; /* `object` is the size and alignment given to the setup, `flags` its flags */
+const uint8_t trace_alloc = 2;
+const uint8_t trace_free = 3;
+const uint8_t trace_shrink = 4;
+const uint8_t trace_release = 5;
+
+/* the first bytes of a trace file of slab_trace_start */
+const char trace_magic[8] = {'S', 'L', 'A', 'B', 'T', 'R', 'C', '1'};
+
+/* trace_setup: bits of `object` below it are the object size, the bits above the order of the alignment */
+const unsigned trace_align_shift = 24;
+
+/**
+ * One event of an allocation trace, in the host byte order
+ **/
+struct trace_record {
+    uint8_t op; /* trace_* operation */
+    uint8_t flags; /* trace_setup: SLAB_* flags of the cache, 0 for other operations */
+    uint16_t cache; /* id of the cache, in the order caches showed up */
+    uint32_t object; /* id of the object, ids of freed objects are reused */
+    uint64_t timestamp; /* nanoseconds since slab_trace_start */
+};
+
+/* SLABs of the allocator, 4096 * 2^order bytes with order in [0; 10] */
+void *alloc_slab(int order);
+void free_slab(void *slab);
+slabStruct *slab_lookup(void *ptr);
+
+/* object caches */
+void cache_setup(struct cache *cache, size_t object_size);
+void cache_setup_ex(struct cache *cache, size_t object_size, size_t align, unsigned flags,
+                    void (*ctor)(void *), void (*dtor)(void *));
+void cache_setup_fixed_order(struct cache *cache, size_t object_size, size_t align, int order);
+void cache_release(struct cache *cache);
+void *cache_alloc(struct cache *cache);
+void *cache_alloc_node(struct cache *cache, int node);
+void cache_free(struct cache *cache, void *ptr);
+void cache_free_to_slab(struct cache *cache, slabStruct *slab, void *ptr);
+size_t cache_alloc_bulk(struct cache *cache, void **out, size_t n);
+void cache_free_bulk(struct cache *cache, void **ptrs, size_t n);
+void *cache_alloc_contiguous(struct cache *cache, size_t k);
+void cache_free_contiguous(struct cache *cache, void *ptr, size_t k);
+void cache_shrink(struct cache *cache);
+bool cache_set_magazine_size(struct cache *cache, size_t rounds);
+size_t cache_shrink_budget(struct cache *cache, size_t max_slabs);
+void cache_set_free_slabs_kept(struct cache *cache, size_t count);
+void cache_set_idle_timeout(struct cache *cache, uint64_t timeout_ms);
+bool cache_set_migrate(struct cache *cache, bool (*migrate)(void *from, void *to));
+size_t cache_defrag(struct cache *cache, size_t max_slabs);
+void cache_stats(struct cache *cache, cache_statistics *stats);
+void slab_stats_dump(FILE *out);
+
+/* caches persisted in files */
+struct cache *cache_attach(const char *path, size_t object_size, size_t align, void *base, size_t size);
+void cache_detach(struct cache *cache);
+void **cache_root(struct cache *cache);
+
+/* background reclaim */
+bool slab_reclaimer_start(unsigned interval_ms, size_t max_slabs);
+void slab_reclaimer_stop();
+size_t slab_purge();
+
+/* pressure signals of the reclaimer, `text` is the content of /proc/pressure/memory or memory.events */
+double psi_some_avg10(const char *text);
+uint64_t memory_events_pressure(const char *text);
+
+#ifdef SLAB_TRACE
+/* allocation traces */
+bool slab_trace_start(const char *path);
+void slab_trace_stop();
+#endif
+
+/* size class caches */
+void *slab_malloc(size_t size);
+void slab_free(void *ptr);
+size_t slab_usable_size(void *ptr);
+
+/* the largest size served by a size class, larger requests get their own SLAB */
+const size_t max_size_class = 8192;
+
+/* the largest size slab_malloc serves, a whole 4Mb SLAB */
+const size_t max_slab_malloc_size = (size_t)4096 << max_slab_order;
+
+#endif //SLAB_ALLOCATOR_SLAB_H
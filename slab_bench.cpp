@@ -0,0 +1,450 @@
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "slab.h"
+
+/* objects allocated in one iteration of the single thread workloads */
+const size_t batch_objects = 4096;
+
+/* objects passed from the producer to the consumer in one iteration */
+const size_t transfer_objects = 64;
+
+/**
+ * Workloads are templates over an allocator of objects
+ * of one size, a struct cache or the linked in malloc
+ **/
+struct slab_cache_allocator {
+    struct cache cache{};
+
+    explicit slab_cache_allocator(size_t size, unsigned flags = 0) {
+        cache_setup_ex(&cache, size, 0, flags, nullptr, nullptr);
+    }
+
+    ~slab_cache_allocator() {
+        cache_release(&cache);
+    }
+
+    void *alloc() {
+        return cache_alloc(&cache);
+    }
+
+    void free(void *ptr) {
+        cache_free(&cache, ptr);
+    }
+
+    size_t alloc_bulk(void **out, size_t n) {
+        return cache_alloc_bulk(&cache, out, n);
+    }
+
+    void free_bulk(void **ptrs, size_t n) {
+        cache_free_bulk(&cache, ptrs, n);
+    }
+};
+
+/**
+ * A cache of SLAB_CONCURRENT mode, threads trade SLABs
+ * through lock-free stacks instead of magazines
+ **/
+struct concurrent_cache_allocator : slab_cache_allocator {
+    explicit concurrent_cache_allocator(size_t size) : slab_cache_allocator(size, SLAB_CONCURRENT) {}
+};
+
+/**
+ * A cache of SLAB_BITMAP format, free slots are found in
+ * the bitmap of the SLAB instead of an intrusive list
+ **/
+struct bitmap_cache_allocator : slab_cache_allocator {
+    explicit bitmap_cache_allocator(size_t size) : slab_cache_allocator(size, SLAB_BITMAP) {}
+};
+
+/**
+ * A cache of SLAB_RED_ZONE mode, the price of the checks
+ * of every allocation and free
+ **/
+struct red_zone_cache_allocator : slab_cache_allocator {
+    explicit red_zone_cache_allocator(size_t size) : slab_cache_allocator(size, SLAB_RED_ZONE) {}
+};
+
+struct malloc_allocator {
+    size_t size;
+
+    explicit malloc_allocator(size_t size) : size(size) {}
+
+    void *alloc() {
+        return malloc(size);
+    }
+
+    void free(void *ptr) {
+        ::free(ptr);
+    }
+
+    size_t alloc_bulk(void **out, size_t n) {
+        for (size_t i = 0; i < n; ++i) {
+            out[i] = malloc(size);
+        }
+        return n;
+    }
+
+    void free_bulk(void **ptrs, size_t n) {
+        for (size_t i = 0; i < n; ++i) {
+            ::free(ptrs[i]);
+        }
+    }
+};
+
+/**
+ * Allocators of any size for the mixed size workload
+ **/
+struct size_class_allocator {
+    void *alloc(size_t size) {
+        return slab_malloc(size);
+    }
+
+    void free(void *ptr) {
+        slab_free(ptr);
+    }
+};
+
+struct malloc_size_allocator {
+    void *alloc(size_t size) {
+        return malloc(size);
+    }
+
+    void free(void *ptr) {
+        ::free(ptr);
+    }
+};
+
+/**
+ * The peak resident set size is reset before every benchmark,
+ * so each one reports its own peak (Linux 4.0 and later)
+ **/
+void reset_peak_rss() {
+    if (FILE *file = fopen("/proc/self/clear_refs", "w")) {
+        fputs("5", file);
+        fclose(file);
+    }
+}
+
+size_t peak_rss() {
+    size_t kilobytes = 0;
+    if (FILE *status = fopen("/proc/self/status", "r")) {
+        char line[128];
+        while (fgets(line, sizeof(line), status)) {
+            if (sscanf(line, "VmHWM: %zu", &kilobytes) == 1) {
+                break;
+            }
+        }
+        fclose(status);
+    }
+    return kilobytes * 1024;
+}
+
+void report(benchmark::State &state, size_t operations) {
+    state.SetItemsProcessed(state.iterations() * operations);
+    state.counters["time/op"] = benchmark::Counter((double)(state.iterations() * operations),
+            benchmark::Counter::kIsRate | benchmark::Counter::kInvert);
+    state.counters["peak_rss"] = benchmark::Counter((double)peak_rss(),
+            benchmark::Counter::kAvgThreads, benchmark::Counter::OneK::kIs1024);
+}
+
+void touch(void *object) {
+    *(volatile char*)object = 1;
+}
+
+/**
+ * Frees objects in the reverse order of allocation, like a stack
+ **/
+template<class Allocator>
+void lifo(benchmark::State &state) {
+    reset_peak_rss();
+    Allocator allocator((size_t)state.range(0));
+    std::vector<void*> objects(batch_objects);
+
+    for (auto _ : state) {
+        for (auto &object : objects) {
+            object = allocator.alloc();
+            touch(object);
+        }
+        for (size_t i = batch_objects; i > 0; --i) {
+            allocator.free(objects[i - 1]);
+        }
+    }
+
+    report(state, 2 * batch_objects);
+}
+
+/**
+ * Frees objects in the order of allocation, like a queue
+ **/
+template<class Allocator>
+void fifo(benchmark::State &state) {
+    reset_peak_rss();
+    Allocator allocator((size_t)state.range(0));
+    std::vector<void*> objects(batch_objects);
+
+    for (auto _ : state) {
+        for (auto &object : objects) {
+            object = allocator.alloc();
+            touch(object);
+        }
+        for (auto object : objects) {
+            allocator.free(object);
+        }
+    }
+
+    report(state, 2 * batch_objects);
+}
+
+/**
+ * Frees objects in a random order, so SLABs are left partially
+ * occupied and the free lists get scattered
+ **/
+template<class Allocator>
+void random_free(benchmark::State &state) {
+    reset_peak_rss();
+    Allocator allocator((size_t)state.range(0));
+    std::vector<void*> objects(batch_objects);
+    std::vector<size_t> order(batch_objects);
+    for (size_t i = 0; i < batch_objects; ++i) {
+        order[i] = i;
+    }
+    std::shuffle(order.begin(), order.end(), std::mt19937(42));
+
+    for (auto _ : state) {
+        for (auto &object : objects) {
+            object = allocator.alloc();
+            touch(object);
+        }
+        for (auto index : order) {
+            allocator.free(objects[index]);
+        }
+    }
+
+    report(state, 2 * batch_objects);
+}
+
+/**
+ * Allocates and frees batches of objects at once
+ **/
+template<class Allocator>
+void bulk(benchmark::State &state) {
+    reset_peak_rss();
+    Allocator allocator((size_t)state.range(0));
+    std::vector<void*> objects(batch_objects);
+    size_t batch = 64;
+    std::vector<size_t> taken(batch_objects / batch);
+
+    for (auto _ : state) {
+        bool short_batch = false;
+        for (size_t i = 0; i < batch_objects; i += batch) {
+            taken[i / batch] = allocator.alloc_bulk(&objects[i], batch);
+            short_batch |= taken[i / batch] < batch;
+        }
+        // only the objects a batch got go back
+        for (size_t i = 0; i < batch_objects; i += batch) {
+            allocator.free_bulk(&objects[i], taken[i / batch]);
+        }
+        if (short_batch) {
+            state.SkipWithError("alloc_bulk returned a short batch");
+            break;
+        }
+    }
+
+    report(state, 2 * batch_objects);
+}
+
+/**
+ * Sizes of the mixed workload, small ones are the most frequent
+ * like in real programs: the size is 8 << k bytes minus a random
+ * part of it with k picked geometrically from [0; 10]
+ **/
+std::vector<size_t> mixed_sizes(size_t count) {
+    std::mt19937 random(7);
+    std::geometric_distribution<int> shift(0.4);
+    std::vector<size_t> sizes(count);
+    for (auto &size : sizes) {
+        size_t top = (size_t)8 << std::min(shift(random), 10);
+        size = top - random() % (top / 2);
+    }
+    return sizes;
+}
+
+/**
+ * Objects of sizes from 5 to 8192 bytes freed in a random order
+ **/
+template<class Allocator>
+void mixed_size_classes(benchmark::State &state) {
+    reset_peak_rss();
+    Allocator allocator;
+    auto sizes = mixed_sizes(batch_objects);
+    std::vector<void*> objects(batch_objects);
+    std::vector<size_t> order(batch_objects);
+    for (size_t i = 0; i < batch_objects; ++i) {
+        order[i] = i;
+    }
+    std::shuffle(order.begin(), order.end(), std::mt19937(42));
+
+    for (auto _ : state) {
+        for (size_t i = 0; i < batch_objects; ++i) {
+            objects[i] = allocator.alloc(sizes[i]);
+            touch(objects[i]);
+        }
+        for (auto index : order) {
+            allocator.free(objects[index]);
+        }
+    }
+
+    report(state, 2 * batch_objects);
+}
+
+/**
+ * Single producer single consumer ring passing objects between threads
+ **/
+struct object_ring {
+    static const size_t capacity = 1 << 14;
+
+    std::atomic<size_t> head{0};
+    std::atomic<size_t> tail{0};
+    void *objects[capacity];
+
+    bool push(void *object) {
+        size_t current = tail.load(std::memory_order_relaxed);
+        if (current - head.load(std::memory_order_acquire) == capacity) {
+            return false;
+        }
+        objects[current % capacity] = object;
+        tail.store(current + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool pop(void **object) {
+        size_t current = head.load(std::memory_order_relaxed);
+        if (current == tail.load(std::memory_order_acquire)) {
+            return false;
+        }
+        *object = objects[current % capacity];
+        head.store(current + 1, std::memory_order_release);
+        return true;
+    }
+};
+
+template<class Allocator>
+struct producer_consumer_state {
+    static Allocator *allocator;
+    static object_ring *ring;
+};
+
+template<class Allocator>
+Allocator *producer_consumer_state<Allocator>::allocator;
+
+template<class Allocator>
+object_ring *producer_consumer_state<Allocator>::ring;
+
+template<class Allocator>
+void producer_consumer_setup(const benchmark::State &state) {
+    reset_peak_rss();
+    producer_consumer_state<Allocator>::allocator = new Allocator((size_t)state.range(0));
+    producer_consumer_state<Allocator>::ring = new object_ring();
+}
+
+template<class Allocator>
+void producer_consumer_teardown(const benchmark::State &) {
+    delete producer_consumer_state<Allocator>::ring;
+    delete producer_consumer_state<Allocator>::allocator;
+}
+
+/**
+ * Thread 0 allocates objects, thread 1 frees them, so
+ * every free is a free of an object of another thread
+ **/
+template<class Allocator>
+void producer_consumer(benchmark::State &state) {
+    auto allocator = producer_consumer_state<Allocator>::allocator;
+    auto ring = producer_consumer_state<Allocator>::ring;
+    bool producer = state.thread_index() == 0;
+
+    for (auto _ : state) {
+        for (size_t i = 0; i < transfer_objects; ++i) {
+            void *object;
+            if (producer) {
+                object = allocator->alloc();
+                touch(object);
+                while (!ring->push(object)) {
+                    std::this_thread::yield();
+                }
+            } else {
+                while (!ring->pop(&object)) {
+                    std::this_thread::yield();
+                }
+                allocator->free(object);
+            }
+        }
+    }
+
+    report(state, transfer_objects);
+}
+
+/**
+ * Bursts of 512 byte objects with cache_shrink and slab_purge
+ * after each, like the reclaimer under memory pressure. The
+ * argument is the idle timeout: 0 frees the SLABs of every burst
+ * and faults their pages in again, others reuse idle SLABs
+ **/
+void shrink_burst(benchmark::State &state) {
+    reset_peak_rss();
+    slab_cache_allocator allocator(512);
+    cache_set_idle_timeout(&allocator.cache, (uint64_t)state.range(0));
+    std::vector<void*> objects(batch_objects);
+
+    for (auto _ : state) {
+        for (auto &object : objects) {
+            object = allocator.alloc();
+            touch(object);
+        }
+        for (auto object : objects) {
+            allocator.free(object);
+        }
+        cache_shrink(&allocator.cache);
+        slab_purge();
+    }
+
+    report(state, 2 * batch_objects);
+}
+
+#define OBJECT_SIZES Arg(16)->Arg(64)->Arg(512)
+
+BENCHMARK_TEMPLATE(lifo, slab_cache_allocator)->OBJECT_SIZES;
+BENCHMARK_TEMPLATE(lifo, bitmap_cache_allocator)->Arg(4)->OBJECT_SIZES;
+BENCHMARK_TEMPLATE(lifo, red_zone_cache_allocator)->OBJECT_SIZES;
+BENCHMARK_TEMPLATE(lifo, malloc_allocator)->OBJECT_SIZES;
+BENCHMARK_TEMPLATE(fifo, slab_cache_allocator)->OBJECT_SIZES;
+BENCHMARK_TEMPLATE(fifo, malloc_allocator)->OBJECT_SIZES;
+BENCHMARK_TEMPLATE(random_free, slab_cache_allocator)->OBJECT_SIZES;
+BENCHMARK_TEMPLATE(random_free, bitmap_cache_allocator)->Arg(4)->OBJECT_SIZES;
+BENCHMARK_TEMPLATE(random_free, red_zone_cache_allocator)->OBJECT_SIZES;
+BENCHMARK_TEMPLATE(random_free, malloc_allocator)->OBJECT_SIZES;
+BENCHMARK_TEMPLATE(bulk, slab_cache_allocator)->OBJECT_SIZES;
+BENCHMARK_TEMPLATE(bulk, bitmap_cache_allocator)->Arg(4)->OBJECT_SIZES;
+BENCHMARK_TEMPLATE(bulk, malloc_allocator)->OBJECT_SIZES;
+BENCHMARK_TEMPLATE(mixed_size_classes, size_class_allocator);
+BENCHMARK_TEMPLATE(mixed_size_classes, malloc_size_allocator);
+BENCHMARK(shrink_burst)->Arg(0)->Arg(1000);
+BENCHMARK_TEMPLATE(producer_consumer, slab_cache_allocator)->Arg(64)->Threads(2)->UseRealTime()
+        ->Setup(producer_consumer_setup<slab_cache_allocator>)
+        ->Teardown(producer_consumer_teardown<slab_cache_allocator>);
+BENCHMARK_TEMPLATE(producer_consumer, concurrent_cache_allocator)->Arg(64)->Threads(2)->UseRealTime()
+        ->Setup(producer_consumer_setup<concurrent_cache_allocator>)
+        ->Teardown(producer_consumer_teardown<concurrent_cache_allocator>);
+BENCHMARK_TEMPLATE(producer_consumer, malloc_allocator)->Arg(64)->Threads(2)->UseRealTime()
+        ->Setup(producer_consumer_setup<malloc_allocator>)
+        ->Teardown(producer_consumer_teardown<malloc_allocator>);
+
+BENCHMARK_MAIN();
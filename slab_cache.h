@@ -0,0 +1,308 @@
+#ifndef SLAB_ALLOCATOR_SLAB_CACHE_H
+#define SLAB_ALLOCATOR_SLAB_CACHE_H
+
+#include <cstdlib>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include "slab.h"
+
+/**
+ * Cache of objects of type T. The object size and
+ * alignment come from the type, construct and destroy
+ * pair cache_alloc/cache_free with the constructor and
+ * the destructor of T like new and delete do
+ **/
+template<class T>
+class SlabCache {
+public:
+    static constexpr size_t object_size = sizeof(T);
+    static constexpr size_t object_align = alignof(T);
+
+    static_assert(object_align <= 4096, "cache_setup_ex aligns objects on 4096 bytes at most");
+
+    explicit SlabCache(unsigned flags = 0) {
+        cache_setup_ex(&cache_, object_size, object_align, flags, nullptr, nullptr);
+    }
+
+    ~SlabCache() {
+        cache_release(&cache_);
+    }
+
+    SlabCache(const SlabCache &) = delete;
+    SlabCache &operator=(const SlabCache &) = delete;
+
+    /**
+     * Memory for one T, nothing is constructed in it.
+     * Returns nullptr when the memory is over
+     **/
+    T *allocate() {
+        return static_cast<T*>(cache_alloc(&cache_));
+    }
+
+    void deallocate(T *object) {
+        cache_free(&cache_, object);
+    }
+
+    /**
+     * Allocates an object and constructs it from `args`.
+     * Throws std::bad_alloc when the memory is over, the
+     * memory goes back to the cache if the constructor throws
+     **/
+    template<class... Args>
+    T *construct(Args&&... args) {
+        void *memory = cache_alloc(&cache_);
+        if (!memory) {
+            throw std::bad_alloc();
+        }
+        try {
+            return new (memory) T(std::forward<Args>(args)...);
+        } catch (...) {
+            cache_free(&cache_, memory);
+            throw;
+        }
+    }
+
+    /**
+     * Destructs an object of construct and frees its memory,
+     * does nothing for nullptr
+     **/
+    void destroy(T *object) {
+        if (!object) {
+            return;
+        }
+        object->~T();
+        cache_free(&cache_, object);
+    }
+
+    void shrink() {
+        cache_shrink(&cache_);
+    }
+
+    struct cache *get() {
+        return &cache_;
+    }
+
+private:
+    struct cache cache_{};
+};
+
+template<class T>
+constexpr size_t SlabCache<T>::object_size;
+
+template<class T>
+constexpr size_t SlabCache<T>::object_align;
+
+/**
+ * Allocator of the standard library taking memory from SLABs.
+ * Single objects, the nodes of std::list, std::set and std::map,
+ * come from a SlabCache shared by every SlabAllocator<T>, arrays
+ * from slab_malloc. Allocators are stateless and all equal
+ **/
+template<class T>
+class SlabAllocator {
+public:
+    typedef T value_type;
+    typedef T *pointer;
+    typedef const T *const_pointer;
+    typedef T &reference;
+    typedef const T &const_reference;
+    typedef size_t size_type;
+    typedef std::ptrdiff_t difference_type;
+    typedef std::true_type propagate_on_container_move_assignment;
+    typedef std::true_type is_always_equal;
+
+    template<class U>
+    struct rebind {
+        typedef SlabAllocator<U> other;
+    };
+
+    SlabAllocator() noexcept = default;
+
+    template<class U>
+    SlabAllocator(const SlabAllocator<U> &) noexcept {}
+
+    T *allocate(size_t n) {
+        void *memory;
+        if (n == 1) {
+            memory = object_cache().allocate();
+        } else if (n > max_slab_malloc_size / sizeof(T)) {
+            throw std::bad_alloc();
+        } else if (alignof(T) <= 16) {
+            // past 8 bytes every size class is aligned at least on 16 bytes
+            memory = slab_malloc(n * sizeof(T));
+        } else {
+            memory = aligned_alloc(alignof(T), n * sizeof(T));
+        }
+
+        if (!memory) {
+            throw std::bad_alloc();
+        }
+        return static_cast<T*>(memory);
+    }
+
+    void deallocate(T *pointer, size_t n) noexcept {
+        if (n == 1) {
+            object_cache().deallocate(pointer);
+        } else if (alignof(T) <= 16) {
+            slab_free(pointer);
+        } else {
+            free(pointer);
+        }
+    }
+
+private:
+    /**
+     * The cache is never released: containers with static
+     * storage may free their nodes after it would be destroyed
+     **/
+    static SlabCache<T> &object_cache() {
+        static auto cache = new SlabCache<T>();
+        return *cache;
+    }
+};
+
+template<class T, class U>
+bool operator==(const SlabAllocator<T> &, const SlabAllocator<U> &) noexcept {
+    return true;
+}
+
+template<class T, class U>
+bool operator!=(const SlabAllocator<T> &, const SlabAllocator<U> &) noexcept {
+    return false;
+}
+
+/**
+ * Geometry of on-slab caches computed at compile time, the
+ * same as cache_setup_ex and calculate_slab_order do at run time
+ **/
+namespace slab_geometry {
+
+constexpr size_t round_up(size_t size, size_t align) {
+    return (size + align - 1) & ~(align - 1);
+}
+
+constexpr size_t object_align(size_t align, size_t current = sizeof(void*)) {
+    return current >= align || current >= 4096 ? current : object_align(align, current << 1);
+}
+
+constexpr size_t object_size(size_t size, size_t align) {
+    return round_up(size < sizeof(void*) ? sizeof(void*) : size, align);
+}
+
+constexpr size_t header_size(size_t align) {
+    return round_up(sizeof(slabStruct), align);
+}
+
+constexpr size_t slab_objects(size_t object_size, size_t header, int order) {
+    return ((size_t)4096 << order) < header + object_size ? 0 : (((size_t)4096 << order) - header) / object_size;
+}
+
+constexpr size_t slab_unused(size_t object_size, size_t header, int order) {
+    return ((size_t)4096 << order) - slab_objects(object_size, header, order) * object_size;
+}
+
+/**
+ * The first order leaving no more than max_slab_waste percents
+ * unused, the one with the smallest unused share otherwise, -1
+ * if an object doesn't fit in the largest SLAB
+ **/
+constexpr int slab_order(size_t object_size, size_t header, int order = 0, int best = -1) {
+    return order > max_slab_order ? best
+        : !slab_objects(object_size, header, order) ? slab_order(object_size, header, order + 1, best)
+        : slab_unused(object_size, header, order) * 100 <= ((size_t)4096 << order) * max_slab_waste ? order
+        : slab_order(object_size, header, order + 1,
+                     best < 0 || slab_unused(object_size, header, order) << best <
+                                 slab_unused(object_size, header, best) << order ? order : best);
+}
+
+}
+
+/**
+ * Cache of `Size` byte objects aligned on `Align` whose SLAB
+ * order, object count, stride and SLAB mask are constants, so
+ * free finds the slabStruct of an object with an immediate mask.
+ * The slabStruct always lives in the SLAB
+ **/
+template<size_t Size, size_t Align = alignof(void*)>
+class StaticSlabCache {
+public:
+    static_assert(Align && !(Align & (Align - 1)) && Align <= 4096, "alignment must be a power of two up to 4096");
+
+    static constexpr size_t object_align = slab_geometry::object_align(Align);
+    static constexpr size_t stride = slab_geometry::object_size(Size, object_align);
+    static constexpr size_t header_size = slab_geometry::header_size(object_align);
+    static constexpr int slab_order = slab_geometry::slab_order(stride, header_size);
+
+    static_assert(slab_order >= 0, "objects don't fit in a SLAB together with its slabStruct");
+
+    static constexpr size_t slab_size = (size_t)4096 << slab_order;
+    static constexpr size_t slab_objects = slab_geometry::slab_objects(stride, header_size, slab_order);
+    static constexpr uintptr_t slab_mask = ~(uintptr_t)(slab_size - 1);
+
+    StaticSlabCache() {
+        cache_setup_fixed_order(&cache_, Size, object_align, slab_order);
+    }
+
+    ~StaticSlabCache() {
+        cache_release(&cache_);
+    }
+
+    StaticSlabCache(const StaticSlabCache &) = delete;
+    StaticSlabCache &operator=(const StaticSlabCache &) = delete;
+
+    static slabStruct *slab_of(void *object) {
+        return (slabStruct*)((uintptr_t)object & slab_mask);
+    }
+
+    /**
+     * Index of an object in its SLAB, the division by
+     * the constant stride compiles to a multiplication
+     **/
+    static size_t index_of(void *object) {
+        return (size_t)((uint8_t*)object - slab_of(object)->objects) / stride;
+    }
+
+    void *allocate() {
+        return cache_alloc(&cache_);
+    }
+
+    void deallocate(void *object) {
+        cache_free_to_slab(&cache_, slab_of(object), object);
+    }
+
+    void shrink() {
+        cache_shrink(&cache_);
+    }
+
+    struct cache *get() {
+        return &cache_;
+    }
+
+private:
+    struct cache cache_{};
+};
+
+template<size_t Size, size_t Align>
+constexpr size_t StaticSlabCache<Size, Align>::object_align;
+
+template<size_t Size, size_t Align>
+constexpr size_t StaticSlabCache<Size, Align>::stride;
+
+template<size_t Size, size_t Align>
+constexpr size_t StaticSlabCache<Size, Align>::header_size;
+
+template<size_t Size, size_t Align>
+constexpr int StaticSlabCache<Size, Align>::slab_order;
+
+template<size_t Size, size_t Align>
+constexpr size_t StaticSlabCache<Size, Align>::slab_size;
+
+template<size_t Size, size_t Align>
+constexpr size_t StaticSlabCache<Size, Align>::slab_objects;
+
+template<size_t Size, size_t Align>
+constexpr uintptr_t StaticSlabCache<Size, Align>::slab_mask;
+
+#endif //SLAB_ALLOCATOR_SLAB_CACHE_H
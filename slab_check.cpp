@@ -0,0 +1,1455 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <list>
+#include <thread>
+#include <vector>
+
+#include <sched.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "slab.h"
+#include "slab_cache.h"
+
+/**
+ * Behaviour checks of the allocator, one per ctest test:
+ * `slab_check <name>` runs one of them and exits with 1
+ * on the first failed expectation
+ **/
+
+#define CHECK(condition) check((condition), #condition, __FILE__, __LINE__)
+
+void check(bool condition, const char *text, const char *file, int line) {
+    if (!condition) {
+        fprintf(stderr, "%s:%d: check failed: %s\n", file, line, text);
+        exit(1);
+    }
+}
+
+/* exit code of checks of features left out of the build, SKIP_RETURN_CODE of their tests */
+const int skip_code = 77;
+
+void skip(const char *reason) {
+    printf("skipped: %s\n", reason);
+    exit(skip_code);
+}
+
+/* the optional argument after the check name, a path for the checks running tools */
+const char *check_argument = nullptr;
+
+cache_statistics stats_of(struct cache *cache) {
+    cache_statistics stats;
+    cache_stats(cache, &stats);
+    return stats;
+}
+
+size_t used_slabs(struct cache *cache) {
+    auto stats = stats_of(cache);
+    return stats.full_slabs + stats.partial_slabs;
+}
+
+size_t slabs_of(struct cache *cache) {
+    auto stats = stats_of(cache);
+    return stats.full_slabs + stats.partial_slabs + stats.free_slabs;
+}
+
+/**
+ * Free lists: slots freed in any order are handed out again
+ * before a new SLAB is taken, and never to two owners
+ **/
+void check_free_list() {
+    struct cache cache{};
+    cache_setup(&cache, 48);
+    // a magazine refill would take objects of a fourth SLAB
+    CHECK(cache_set_magazine_size(&cache, 0));
+
+    size_t count = 3 * stats_of(&cache).slab_objects;
+    std::vector<size_t*> objects(count);
+    for (size_t i = 0; i < count; ++i) {
+        objects[i] = (size_t*)cache_alloc(&cache);
+        CHECK(objects[i] != nullptr);
+        *objects[i] = i;
+    }
+    CHECK(used_slabs(&cache) == 3);
+
+    // every third object, from the middle of the SLABs too
+    std::vector<size_t*> freed;
+    for (size_t i = 1; i < count; i += 3) {
+        freed.push_back(objects[i]);
+        cache_free(&cache, objects[i]);
+        objects[i] = nullptr;
+    }
+    std::vector<size_t*> again(freed.size());
+    for (auto &object : again) {
+        object = (size_t*)cache_alloc(&cache);
+        CHECK(object != nullptr);
+        *object = SIZE_MAX;
+    }
+    CHECK(used_slabs(&cache) == 3);
+    std::sort(freed.begin(), freed.end());
+    std::sort(again.begin(), again.end());
+    CHECK(freed == again);
+    for (size_t i = 0; i < count; ++i) {
+        CHECK(!objects[i] || *objects[i] == i);
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        if (objects[i]) {
+            cache_free(&cache, objects[i]);
+        }
+    }
+    for (auto object : again) {
+        cache_free(&cache, object);
+    }
+    cache_release(&cache);
+}
+
+/**
+ * List moves: a full SLAB losing an object becomes partial
+ * and serves the next allocation, the list counters follow
+ **/
+void check_full_slab() {
+    struct cache cache{};
+    cache_setup(&cache, 48);
+    // frees must reach the SLABs at once
+    CHECK(cache_set_magazine_size(&cache, 0));
+
+    size_t per_slab = stats_of(&cache).slab_objects;
+    std::vector<void*> objects(4 * per_slab);
+    for (auto &object : objects) {
+        object = cache_alloc(&cache);
+        CHECK(object != nullptr);
+    }
+    CHECK(stats_of(&cache).full_slabs == 4);
+    CHECK(stats_of(&cache).partial_slabs == 0);
+
+    // one object of every SLAB
+    for (size_t i = 0; i < objects.size(); i += per_slab) {
+        cache_free(&cache, objects[i]);
+    }
+    CHECK(stats_of(&cache).full_slabs == 0);
+    CHECK(stats_of(&cache).partial_slabs == 4);
+
+    for (size_t i = 0; i < objects.size(); i += per_slab) {
+        objects[i] = cache_alloc(&cache);
+        CHECK(objects[i] != nullptr);
+    }
+    CHECK(stats_of(&cache).full_slabs == 4);
+    CHECK(stats_of(&cache).partial_slabs == 0);
+
+    for (auto object : objects) {
+        cache_free(&cache, object);
+    }
+    CHECK(stats_of(&cache).free_slabs == 4);
+    CHECK(used_slabs(&cache) == 0);
+    cache_release(&cache);
+}
+
+/**
+ * SLAB geometry: the chosen order leaves at most max_slab_waste
+ * percents of a SLAB unused, large objects share SLABs
+ **/
+void check_slab_order() {
+    for (size_t size : {24, 100, 700, 1500, 2100, 3000, 5000, 6000, 12000}) {
+        struct cache cache{};
+        cache_setup(&cache, size);
+        auto stats = stats_of(&cache);
+
+        CHECK(stats.slab_objects * stats.slot_size <= stats.slab_size);
+        CHECK((stats.slab_size - stats.slab_objects * stats.slot_size) * 100 <= stats.slab_size * max_slab_waste);
+        CHECK(stats.slab_objects > 1);
+
+        auto object = cache_alloc(&cache);
+        CHECK(object != nullptr);
+        memset(object, 1, size);
+        cache_free(&cache, object);
+        cache_release(&cache);
+    }
+}
+
+/**
+ * Magazines: objects freed by several threads pass through their
+ * magazines and the depot, a thread started after them takes
+ * over the magazines they left, and cache_shrink brings every
+ * object back to its SLAB
+ **/
+void check_magazines() {
+    struct cache cache{};
+    cache_setup(&cache, 64);
+    CHECK(cache.magazine_size > 0);
+#ifdef SLAB_USE_RSEQ
+    if (cache.cpu_stacks) {
+        skip("per-CPU stacks take the place of magazines");
+    }
+#endif
+
+    // every thread frees more full magazines than the depot keeps
+    const size_t threads = 4;
+    const size_t count = 2 * depot_full_limit * cache.magazine_size;
+    std::vector<void*> objects(threads * count);
+    for (auto &object : objects) {
+        object = cache_alloc(&cache);
+        CHECK(object != nullptr);
+    }
+    size_t slabs = slabs_of(&cache);
+
+    std::vector<std::thread> workers;
+    for (size_t t = 0; t < threads; ++t) {
+        workers.emplace_back([&cache, &objects, t, count] {
+            for (size_t i = t * count; i < (t + 1) * count; ++i) {
+                cache_free(&cache, objects[i]);
+            }
+        });
+    }
+    for (auto &worker : workers) {
+        worker.join();
+    }
+
+    // the objects of the magazines and the depot are allocated again before any new SLAB
+    std::thread([&cache, count] {
+        std::vector<void*> again(count);
+        for (auto &object : again) {
+            object = cache_alloc(&cache);
+            CHECK(object != nullptr);
+        }
+        for (auto object : again) {
+            cache_free(&cache, object);
+        }
+    }).join();
+    CHECK(slabs_of(&cache) == slabs);
+
+    cache_shrink(&cache);
+    CHECK(slabs_of(&cache) == 0);
+    cache_release(&cache);
+}
+
+/**
+ * Per-CPU stacks: threads allocating and freeing at once never
+ * get the same object, and cache_shrink run on every CPU in
+ * turn empties all the stacks
+ **/
+void check_rseq() {
+#ifdef SLAB_USE_RSEQ
+    struct cache cache{};
+    cache_setup(&cache, 64);
+    if (!cache.cpu_stacks) {
+        skip("glibc didn't register rseq");
+    }
+
+    const size_t threads = 8;
+    const size_t rounds = 2000;
+    const size_t batch = 3 * cache.magazine_size;
+    std::vector<std::thread> workers;
+    for (size_t t = 0; t < threads; ++t) {
+        workers.emplace_back([&cache, t, rounds, batch] {
+            std::vector<size_t*> objects(batch);
+            for (size_t round = 0; round < rounds; ++round) {
+                for (size_t i = 0; i < batch; ++i) {
+                    objects[i] = (size_t*)cache_alloc(&cache);
+                    CHECK(objects[i] != nullptr);
+                    *objects[i] = t * batch + i;
+                }
+                // an object handed to two threads at once is overwritten by the other one
+                for (size_t i = 0; i < batch; ++i) {
+                    CHECK(*objects[i] == t * batch + i);
+                    cache_free(&cache, objects[i]);
+                }
+            }
+        });
+    }
+    for (auto &worker : workers) {
+        worker.join();
+    }
+
+    // a shrink empties the stack of the CPU it runs on
+    cpu_set_t original;
+    CHECK(sched_getaffinity(0, sizeof(original), &original) == 0);
+    for (size_t cpu = 0; cpu < cache.cpu_count; ++cpu) {
+        cpu_set_t one;
+        CPU_ZERO(&one);
+        CPU_SET(cpu, &one);
+        if (sched_setaffinity(0, sizeof(one), &one) == 0) {
+            cache_shrink(&cache);
+        } else {
+            CHECK(cache.cpu_stacks[cpu].count == 0);
+        }
+    }
+    CHECK(sched_setaffinity(0, sizeof(original), &original) == 0);
+    CHECK(slabs_of(&cache) == 0);
+    cache_release(&cache);
+#else
+    skip("built without SLAB_USE_RSEQ");
+#endif
+}
+
+/**
+ * Remote frees: objects freed by another thread than the SLAB
+ * owner wait on the remote list of the SLAB, the next allocation
+ * of the owner takes them back instead of a new SLAB
+ **/
+void check_remote_free() {
+    struct cache cache{};
+    cache_setup(&cache, 64);
+    // magazines and per-CPU stacks would take the frees before the SLAB
+    CHECK(cache_set_magazine_size(&cache, 0));
+
+    size_t count = cache.slab_objects;
+    std::vector<void*> objects(count);
+    for (auto &object : objects) {
+        object = cache_alloc(&cache);
+        CHECK(object != nullptr);
+    }
+    auto slab = slab_lookup(objects[0]);
+    auto &node = cache.nodes[slab->node];
+    CHECK(slab->refcnt == count && node.empty_count == 1 && node.partially_count == 0);
+
+    std::thread([&cache, &objects] {
+        for (auto object : objects) {
+            cache_free(&cache, object);
+        }
+    }).join();
+    CHECK(slab->refcnt == count && node.empty_count == 1);
+    CHECK(slab->remote_free.load() != nullptr && cache.remote_slabs.load() == slab);
+
+    std::vector<void*> again(count);
+    again[0] = cache_alloc(&cache);
+    CHECK(slab->remote_free.load() == nullptr && cache.remote_slabs.load() == nullptr);
+    CHECK(slab->refcnt == 1 && node.empty_count == 0 && node.partially_count == 1 && node.complete_count == 0);
+    for (size_t i = 1; i < count; ++i) {
+        again[i] = cache_alloc(&cache);
+    }
+    CHECK(slab->refcnt == count && node.empty_count == 1 && node.partially_count == 0);
+    CHECK(slabs_of(&cache) == 1);
+
+    std::sort(objects.begin(), objects.end());
+    std::sort(again.begin(), again.end());
+    CHECK(objects == again);
+
+    // frees of the owner go straight to the SLAB
+    for (auto object : again) {
+        cache_free(&cache, object);
+    }
+    CHECK(slab->refcnt == 0 && node.complete_count == 1 && cache.remote_slabs.load() == nullptr);
+    cache_release(&cache);
+}
+
+/**
+ * cache_alloc_bulk/cache_free_bulk: a batch spans SLABs, its
+ * objects are distinct and go back in any order
+ **/
+void check_bulk() {
+    struct cache cache{};
+    cache_setup(&cache, 64);
+
+    size_t count = 2 * stats_of(&cache).slab_objects + 10;
+    std::vector<void*> objects(count);
+    CHECK(cache_alloc_bulk(&cache, objects.data(), count) == count);
+    for (size_t i = 0; i < count; ++i) {
+        memset(objects[i], (int)i, 64);
+    }
+    CHECK(used_slabs(&cache) == 3);
+    auto sorted = objects;
+    std::sort(sorted.begin(), sorted.end());
+    CHECK(std::adjacent_find(sorted.begin(), sorted.end()) == sorted.end());
+
+    // SLABs interleaved in the batch
+    std::vector<void*> mixed;
+    for (size_t i = 0; i < count; i += 2) {
+        mixed.push_back(objects[i]);
+    }
+    for (size_t i = 1; i < count; i += 2) {
+        mixed.push_back(objects[i]);
+    }
+    cache_free_bulk(&cache, mixed.data(), mixed.size());
+    CHECK(used_slabs(&cache) == 0);
+#ifdef SLAB_STATS
+    CHECK(stats_of(&cache).allocs == count);
+    CHECK(stats_of(&cache).frees == count);
+#endif
+
+    CHECK(cache_alloc_bulk(&cache, objects.data(), 0) == 0);
+    cache_release(&cache);
+}
+
+/**
+ * slab_malloc: every size up to max_size_class is rounded up
+ * by at most 12.5% or 16 bytes and aligned like malloc, larger
+ * ones get a SLAB of their own, slab_free takes them all
+ **/
+void check_size_classes() {
+    std::vector<void*> objects;
+    for (size_t size = 1; size <= max_size_class; ++size) {
+        auto object = slab_malloc(size);
+        CHECK(object != nullptr);
+        size_t usable = slab_usable_size(object);
+        CHECK(usable >= size && usable <= std::max(size + 15, size + size / 8));
+        CHECK((uintptr_t)object % (size > 8 ? 16 : 8) == 0);
+        memset(object, 1, size);
+        objects.push_back(object);
+    }
+    for (auto object : objects) {
+        slab_free(object);
+    }
+
+    auto large = slab_malloc(100000);
+    CHECK(large != nullptr && slab_usable_size(large) == 131072);
+    slab_free(large);
+    CHECK(slab_lookup(large) == nullptr);
+    CHECK(slab_malloc(max_slab_malloc_size + 1) == nullptr);
+    slab_free(nullptr);
+}
+
+/**
+ * The buddy arena: order-0 SLABs given back by a shrink merge
+ * into 4Mb blocks again, which serve order-10 SLABs without
+ * taking fresh memory from the range
+ **/
+void check_buddy() {
+    struct cache cache{};
+    cache_setup_fixed_order(&cache, 64, 0, 0);
+
+    size_t slabs = 2048;
+    size_t count = slabs * stats_of(&cache).slab_objects;
+    std::vector<void*> objects;
+    for (size_t i = 0; i < count; ++i) {
+        objects.push_back(cache_alloc(&cache));
+        CHECK(objects.back() != nullptr);
+    }
+    CHECK(used_slabs(&cache) == slabs);
+    auto low = (uint8_t*)*std::min_element(objects.begin(), objects.end());
+    auto high = (uint8_t*)*std::max_element(objects.begin(), objects.end());
+
+    // every other SLAB first, so buddies come back apart
+    for (size_t i = 0; i < count; ++i) {
+        if ((i / stats_of(&cache).slab_objects) % 2) {
+            cache_free(&cache, objects[i]);
+        }
+    }
+    cache_shrink(&cache);
+    for (size_t i = 0; i < count; ++i) {
+        if ((i / stats_of(&cache).slab_objects) % 2 == 0) {
+            cache_free(&cache, objects[i]);
+        }
+    }
+    cache_shrink(&cache);
+    CHECK(used_slabs(&cache) == 0);
+    CHECK(stats_of(&cache).free_slabs == 0);
+
+    auto first = (uint8_t*)alloc_slab(10);
+    auto second = (uint8_t*)alloc_slab(10);
+    CHECK(first && second && first != second);
+    CHECK(first >= low - 4096 && first < high);
+    CHECK(second >= low - 4096 && second < high);
+    free_slab(first);
+    free_slab(second);
+    cache_release(&cache);
+}
+
+/**
+ * SLAB_HUGEPAGE: the huge page arena serves SLABs whether or
+ * not the MAP_HUGETLB pool has free pages, without them its
+ * blocks fall back to transparent huge pages
+ **/
+void check_hugepage() {
+    struct cache cache{};
+    cache_setup_ex(&cache, 1024, 0, SLAB_HUGEPAGE, nullptr, nullptr);
+
+    // several max_slab_order blocks, each one taken by arena_grow
+    size_t count = 3 * ((size_t)4096 << max_slab_order) / 1024;
+    std::vector<void*> objects(count);
+    CHECK(cache_alloc_bulk(&cache, objects.data(), count) == count);
+    for (auto object : objects) {
+        CHECK(slab_lookup(object) != nullptr);
+        memset(object, 1, 1024);
+    }
+    std::sort(objects.begin(), objects.end());
+    CHECK(std::adjacent_find(objects.begin(), objects.end()) == objects.end());
+
+    cache_free_bulk(&cache, objects.data(), count);
+    cache_shrink(&cache);
+    CHECK(slabs_of(&cache) == 0);
+    cache_release(&cache);
+}
+
+/**
+ * cache_alloc_node: objects of a node come from SLABs of its
+ * lists and pages, nodes out of range get nothing
+ **/
+void check_numa_node() {
+    struct cache cache{};
+    cache_setup(&cache, 64);
+
+    auto object = cache_alloc_node(&cache, 0);
+    CHECK(object != nullptr);
+    CHECK(slab_lookup(object)->node == 0);
+    CHECK(cache.nodes[0].partially_count == 1);
+
+    // move_pages without target nodes reports the node of the page
+    memset(object, 1, 64);
+    void *page = (void*)((uintptr_t)object & ~(uintptr_t)4095);
+    int status = -1;
+    if (syscall(SYS_move_pages, 0, 1, &page, nullptr, &status, 0) == 0) {
+        CHECK(status == 0);
+    }
+
+    CHECK(cache_alloc_node(&cache, -1) == nullptr);
+    CHECK(cache_alloc_node(&cache, max_numa_nodes) == nullptr);
+    cache_free(&cache, object);
+    cache_shrink(&cache);
+    CHECK(slabs_of(&cache) == 0);
+    cache_release(&cache);
+}
+
+/**
+ * Colouring: SLABs shift their objects by cache lines within
+ * the unused tail, so equal slots of SLABs hit other cache sets
+ **/
+void check_colour() {
+    struct cache cache{};
+    cache_setup(&cache, 1500);
+    auto stats = stats_of(&cache);
+    CHECK(!cache.off_slab);
+
+    size_t count = 12 * stats.slab_objects;
+    std::vector<void*> objects(count);
+    CHECK(cache_alloc_bulk(&cache, objects.data(), count) == count);
+
+    std::vector<size_t> shifts;
+    for (size_t i = 0; i < count; i += stats.slab_objects) {
+        auto slab = slab_lookup(objects[i]);
+        CHECK(slab != nullptr);
+        auto shift = (size_t)(slab->objects - (uint8_t*)slab);
+        CHECK(slab->objects + stats.slab_objects * stats.slot_size <= (uint8_t*)slab + stats.slab_size);
+        shifts.push_back(shift);
+    }
+    auto first = *std::min_element(shifts.begin(), shifts.end());
+    for (auto shift : shifts) {
+        CHECK((shift - first) % cache_line_size == 0);
+    }
+    std::sort(shifts.begin(), shifts.end());
+    CHECK(std::unique(shifts.begin(), shifts.end()) - shifts.begin() > 1);
+
+    cache_free_bulk(&cache, objects.data(), count);
+    cache_release(&cache);
+}
+
+/**
+ * Alignment: objects of a requested alignment, or of
+ * SLAB_HWCACHE_ALIGN, stay aligned in every coloured SLAB
+ **/
+void check_alignment() {
+    struct setup {
+        size_t size;
+        size_t align;
+        unsigned flags;
+        size_t expected;
+    };
+    for (auto test : {setup{100, 256, 0, 256}, setup{100, 0, SLAB_HWCACHE_ALIGN, 64},
+                      setup{20, 0, SLAB_HWCACHE_ALIGN, 32}, setup{700, 0, SLAB_HWCACHE_ALIGN, 64},
+                      setup{24, 48, 0, 64}, setup{24, 0, 0, sizeof(void*)}}) {
+        struct cache cache{};
+        cache_setup_ex(&cache, test.size, test.align, test.flags, nullptr, nullptr);
+        auto stats = stats_of(&cache);
+        CHECK(stats.slot_size % test.expected == 0);
+        CHECK(stats.slot_size < test.size + test.expected);
+
+        size_t count = 8 * stats.slab_objects;
+        std::vector<void*> objects(count);
+        CHECK(cache_alloc_bulk(&cache, objects.data(), count) == count);
+        for (auto object : objects) {
+            CHECK((uintptr_t)object % test.expected == 0);
+        }
+        cache_free_bulk(&cache, objects.data(), count);
+        cache_release(&cache);
+    }
+}
+
+/* objects built and torn down by the hooks of check_ctor_dtor */
+size_t constructed;
+size_t destructed;
+
+void count_ctor(void *object) {
+    *(uint64_t*)object = 0xc0ffee;
+    constructed += 1;
+}
+
+void count_dtor(void *object) {
+    CHECK(*(uint64_t*)object == 0xc0ffee);
+    destructed += 1;
+}
+
+/**
+ * Constructors run once per object when its SLAB is made,
+ * freed objects keep their constructed state, destructors
+ * run when the SLAB goes back
+ **/
+void check_ctor_dtor() {
+    struct cache cache{};
+    cache_setup_ex(&cache, 40, 0, 0, count_ctor, count_dtor);
+    auto stats = stats_of(&cache);
+
+    std::vector<void*> objects(stats.slab_objects);
+    CHECK(cache_alloc_bulk(&cache, objects.data(), objects.size()) == objects.size());
+    CHECK(constructed == stats.slab_objects);
+    for (auto object : objects) {
+        CHECK(*(uint64_t*)object == 0xc0ffee);
+        ((uint64_t*)object)[1] = 7;
+    }
+
+    // state set while the object was allocated stays too
+    for (size_t round = 0; round < 3; ++round) {
+        cache_free_bulk(&cache, objects.data(), objects.size());
+        CHECK(cache_alloc_bulk(&cache, objects.data(), objects.size()) == objects.size());
+        for (auto object : objects) {
+            CHECK(*(uint64_t*)object == 0xc0ffee && ((uint64_t*)object)[1] == 7);
+        }
+    }
+    CHECK(constructed == stats.slab_objects);
+    CHECK(destructed == 0);
+
+    cache_free_bulk(&cache, objects.data(), objects.size());
+    cache_shrink(&cache);
+    CHECK(destructed == stats.slab_objects);
+
+    // a release destructs the objects of SLABs still held
+    auto object = cache_alloc(&cache);
+    CHECK(object != nullptr && *(uint64_t*)object == 0xc0ffee);
+    cache_free(&cache, object);
+    cache_release(&cache);
+    CHECK(destructed == constructed);
+}
+
+/* live objects of check_slab_cache, kept by its constructor and destructor */
+int live_points;
+
+struct alignas(32) point {
+    int x;
+    int y;
+
+    point(int x, int y) : x(x), y(y) {
+        live_points += 1;
+    }
+
+    ~point() {
+        live_points -= 1;
+    }
+};
+
+/**
+ * SlabCache<T> constructs and destroys objects sized and aligned
+ * from T, containers of SlabAllocator<T> keep nodes and arrays
+ * in SLABs
+ **/
+void check_slab_cache() {
+    SlabCache<point> points;
+    auto stats = stats_of(points.get());
+    CHECK(stats.slot_size == sizeof(point));
+
+    std::vector<point*> objects;
+    for (int i = 0; i < 1000; ++i) {
+        objects.push_back(points.construct(i, -i));
+        CHECK((uintptr_t)objects.back() % alignof(point) == 0);
+    }
+    CHECK(live_points == 1000);
+    for (int i = 0; i < 1000; ++i) {
+        CHECK(objects[i]->x == i && objects[i]->y == -i);
+        points.destroy(objects[i]);
+    }
+    points.destroy(nullptr);
+    CHECK(live_points == 0);
+    points.shrink();
+    CHECK(used_slabs(points.get()) == 0);
+
+    std::list<int, SlabAllocator<int>> list;
+    std::vector<int, SlabAllocator<int>> array;
+    for (int i = 0; i < 1000; ++i) {
+        list.push_back(i);
+        array.push_back(i);
+    }
+    CHECK(slab_lookup(&list.front()) != nullptr);
+    CHECK(slab_lookup(array.data()) != nullptr);
+    CHECK(list.size() == 1000 && array[999] == 999);
+}
+
+/**
+ * StaticSlabCache: the constant geometry is the one the cache
+ * gets at run time, frees through the constant mask work
+ **/
+template<size_t Size, size_t Align>
+void check_static_geometry() {
+    StaticSlabCache<Size, Align> cache;
+    typedef StaticSlabCache<Size, Align> type;
+    auto stats = stats_of(cache.get());
+    CHECK(stats.slab_size == type::slab_size);
+    CHECK(stats.slab_objects == type::slab_objects);
+    CHECK(stats.slot_size == type::stride);
+
+    std::vector<void*> objects;
+    for (size_t i = 0; i < 3 * type::slab_objects; ++i) {
+        objects.push_back(cache.allocate());
+        CHECK(objects.back() != nullptr);
+        CHECK(type::slab_of(objects.back())->cache == cache.get());
+        CHECK(type::index_of(objects.back()) < type::slab_objects);
+    }
+    for (auto object : objects) {
+        cache.deallocate(object);
+    }
+    cache.shrink();
+    CHECK(used_slabs(cache.get()) == 0);
+}
+
+void check_static_slab_cache() {
+    check_static_geometry<48, 8>();
+    check_static_geometry<100, 64>();
+    check_static_geometry<2000, 16>();
+}
+
+/**
+ * cache_shrink_budget: only SLABs free since the previous call
+ * beyond the kept ones go, half of them per call and within the
+ * budget, SLABs reused in between count against the watermark
+ **/
+void check_shrink_budget() {
+    struct cache cache{};
+    cache_setup(&cache, 64);
+    cache_set_free_slabs_kept(&cache, 2);
+
+    size_t per_slab = stats_of(&cache).slab_objects;
+    std::vector<void*> objects(10 * per_slab);
+    CHECK(cache_alloc_bulk(&cache, objects.data(), objects.size()) == objects.size());
+    cache_free_bulk(&cache, objects.data(), objects.size());
+    CHECK(stats_of(&cache).free_slabs == 10);
+
+    // the SLABs were not free at the previous call
+    CHECK(cache_shrink_budget(&cache, 100) == 0);
+    CHECK(cache_shrink_budget(&cache, 1) == 1);
+    CHECK(stats_of(&cache).free_slabs == 9);
+
+    // three SLABs in use between the calls lower the watermark to 6
+    CHECK(cache_alloc_bulk(&cache, objects.data(), 3 * per_slab) == 3 * per_slab);
+    cache_free_bulk(&cache, objects.data(), 3 * per_slab);
+    CHECK(cache_shrink_budget(&cache, 100) == 2);
+    CHECK(stats_of(&cache).free_slabs == 7);
+
+    // the rest decays down to the kept SLABs
+    CHECK(cache_shrink_budget(&cache, 100) == 3);
+    CHECK(cache_shrink_budget(&cache, 100) == 1);
+    CHECK(cache_shrink_budget(&cache, 100) == 1);
+    CHECK(cache_shrink_budget(&cache, 100) == 0);
+    CHECK(stats_of(&cache).free_slabs == 2);
+
+    cache_shrink(&cache);
+    CHECK(stats_of(&cache).free_slabs == 0);
+    cache_release(&cache);
+}
+
+/**
+ * Reclaimer: the pressure signals are read from the texts of
+ * PSI and memory.events, the thread runs once at a time, shrinks
+ * free SLABs down to the watermark and is joined by the stop
+ **/
+void check_reclaimer() {
+    CHECK(psi_some_avg10("some avg10=12.50 avg60=3.00 avg300=1.00 total=123456\n"
+                         "full avg10=7.25 avg60=1.00 avg300=0.50 total=2345\n") == 12.5);
+    CHECK(psi_some_avg10("some avg10=0.00 avg60=0.00 avg300=0.00 total=0\n") == 0);
+    CHECK(psi_some_avg10("full avg10=7.25 avg60=1.00 avg300=0.50 total=2345\n") == 0);
+    CHECK(psi_some_avg10("") == 0);
+    CHECK(memory_events_pressure("low 5\nhigh 2\nmax 3\noom 1\noom_kill 7\noom_group_kill 0\n") == 6);
+    CHECK(memory_events_pressure("low 5\n") == 0);
+    CHECK(memory_events_pressure("") == 0);
+
+    struct cache cache{};
+    cache_setup(&cache, 64);
+    size_t count = 4 * (cache.free_slabs_kept + 1) * cache.slab_objects;
+    std::vector<void*> objects(count);
+    CHECK(cache_alloc_bulk(&cache, objects.data(), count) == count);
+    cache_free_bulk(&cache, objects.data(), count);
+    CHECK(stats_of(&cache).free_slabs > cache.free_slabs_kept);
+
+    CHECK(slab_reclaimer_start(1, 1));
+    CHECK(!slab_reclaimer_start(1, 1));
+    for (int i = 0; i < 5000 && stats_of(&cache).free_slabs > cache.free_slabs_kept; ++i) {
+        usleep(1000);
+    }
+    CHECK(stats_of(&cache).free_slabs <= cache.free_slabs_kept);
+    slab_reclaimer_stop();
+
+    // the stopped thread is joined, a new one starts
+    CHECK(slab_reclaimer_start(1, 1));
+    slab_reclaimer_stop();
+    slab_reclaimer_stop();
+    cache_release(&cache);
+}
+
+/* objects of check_defrag by their index, kept by migrate_indexed */
+std::vector<size_t*> indexed_objects;
+
+bool migrate_indexed(void *from, void *to) {
+    auto index = *(size_t*)from;
+    memcpy(to, from, 64);
+    indexed_objects[index] = (size_t*)to;
+    return true;
+}
+
+/**
+ * cache_defrag: the objects of sparse SLABs move to fuller
+ * ones through the callback, the emptied SLABs are freed by
+ * the next shrink
+ **/
+void check_defrag() {
+    struct cache cache{};
+    cache_setup(&cache, 64);
+    CHECK(cache_set_migrate(&cache, migrate_indexed));
+
+    size_t slabs = 16;
+    size_t count = slabs * stats_of(&cache).slab_objects;
+    for (size_t i = 0; i < count; ++i) {
+        auto object = (size_t*)cache_alloc(&cache);
+        CHECK(object != nullptr);
+        *object = i;
+        indexed_objects.push_back(object);
+    }
+    // every SLAB keeps 1/8 of its objects, under the 1/4 cache_defrag takes
+    for (size_t i = 0; i < count; ++i) {
+        if (i % 8) {
+            cache_free(&cache, indexed_objects[i]);
+            indexed_objects[i] = nullptr;
+        }
+    }
+    CHECK(used_slabs(&cache) == slabs);
+
+    size_t emptied = cache_defrag(&cache, slabs);
+    CHECK(emptied > slabs / 2);
+    cache_shrink(&cache);
+    CHECK(used_slabs(&cache) == slabs - emptied);
+#ifdef SLAB_STATS
+    CHECK(stats_of(&cache).active_objects == count / 8);
+#endif
+    for (size_t i = 0; i < count; i += 8) {
+        CHECK(*indexed_objects[i] == i);
+    }
+
+    for (auto object : indexed_objects) {
+        if (object) {
+            cache_free(&cache, object);
+        }
+    }
+    cache_shrink(&cache);
+    CHECK(used_slabs(&cache) == 0);
+    cache_release(&cache);
+
+    // a cache holding objects, maybe in magazines, is left alone
+    struct cache late{};
+    cache_setup(&late, 64);
+    auto object = cache_alloc(&late);
+    cache_free(&late, object);
+    CHECK(!cache_set_migrate(&late, migrate_indexed));
+    CHECK(cache_defrag(&late, 1) == 0);
+    cache_release(&late);
+}
+
+/**
+ * slab_stats_dump: a header and a row of every cache with the
+ * numbers of cache_stats
+ **/
+void check_stats_dump() {
+    struct cache cache{};
+    cache_setup(&cache, 100);
+    void *objects[10];
+    CHECK(cache_alloc_bulk(&cache, objects, 10) == 10);
+
+    char *text = nullptr;
+    size_t length = 0;
+    FILE *out = open_memstream(&text, &length);
+    CHECK(out != nullptr);
+    slab_stats_dump(out);
+    fclose(out);
+
+    const char header[] = "# cache : <objsize> <slotsize> <objperslab> <pagesperslab> <magazine>";
+    CHECK(strncmp(text, header, sizeof(header) - 1) == 0);
+
+    char prefix[32];
+    snprintf(prefix, sizeof(prefix), "\n%p : ", (void*)&cache);
+    auto row = strstr(text, prefix);
+    CHECK(row != nullptr);
+    size_t object_size, slot_size, slab_objects, pages, magazine_size, active, total, full, partial, empty;
+    unsigned long long allocs, frees, slab_allocs, slab_frees;
+    CHECK(sscanf(row + strlen(prefix), "%zu %zu %zu %zu %zu : %zu %zu %llu %llu : slabdata %zu %zu %zu %llu %llu",
+                 &object_size, &slot_size, &slab_objects, &pages, &magazine_size, &active, &total, &allocs, &frees,
+                 &full, &partial, &empty, &slab_allocs, &slab_frees) == 14);
+    CHECK(slot_size == cache.object_size && slab_objects == cache.slab_objects);
+    CHECK(pages == (size_t)1 << cache.slab_order && magazine_size == cache.magazine_size);
+    CHECK(total == cache.slab_objects && full == 0 && partial == 1 && empty == 0);
+#ifdef SLAB_STATS
+    CHECK(object_size == 100 && active == 10 && allocs == 10 && frees == 0);
+    CHECK(slab_allocs == 1 && slab_frees == 0);
+#endif
+    free(text);
+
+    cache_free_bulk(&cache, objects, 10);
+    cache_release(&cache);
+}
+
+/**
+ * Traces: slab_replay replays a recorded workload and refuses
+ * the trace once it is cut inside a record. The argument of
+ * the check is the path of slab_replay
+ **/
+void check_trace() {
+#ifdef SLAB_TRACE
+    CHECK(check_argument != nullptr);
+    char path[] = "/tmp/slab_trace_XXXXXX";
+    int fd = mkstemp(path);
+    CHECK(fd >= 0);
+    close(fd);
+
+    CHECK(slab_trace_start(path));
+    CHECK(!slab_trace_start(path));
+    struct cache cache{};
+    cache_setup(&cache, 48);
+    std::vector<void*> objects(1000);
+    for (auto &object : objects) {
+        object = cache_alloc(&cache);
+        CHECK(object != nullptr);
+    }
+    for (size_t i = 0; i < objects.size(); i += 2) {
+        cache_free(&cache, objects[i]);
+    }
+    cache_shrink(&cache);
+    for (size_t i = 1; i < objects.size(); i += 2) {
+        cache_free(&cache, objects[i]);
+    }
+    cache_release(&cache);
+    slab_trace_stop();
+
+    char command[256];
+    snprintf(command, sizeof(command), "%s %s > /dev/null", check_argument, path);
+    CHECK(system(command) == 0);
+
+    struct stat recorded;
+    CHECK(stat(path, &recorded) == 0);
+    CHECK(truncate(path, recorded.st_size - 1) == 0);
+    CHECK(system(command) != 0);
+    unlink(path);
+#else
+    skip("built without SLAB_TRACE");
+#endif
+}
+
+/* a global object slab_lookup must not take for SLAB memory */
+uint64_t global_object;
+
+/**
+ * slab_lookup: any pointer into a SLAB finds it, pointers of the
+ * stack, the heap and globals don't, slab_free ignores them
+ **/
+void check_lookup() {
+    struct cache cache{};
+    cache_setup(&cache, 200);
+    auto object = (uint8_t*)cache_alloc(&cache);
+    CHECK(object != nullptr);
+    auto slab = slab_lookup(object);
+    CHECK(slab != nullptr && slab->cache == &cache);
+    CHECK(slab_lookup(object + 199) == slab);
+    CHECK(slab_usable_size(object) >= 200);
+
+    uint64_t local = 0;
+    auto heap = (uint64_t*)malloc(64);
+    CHECK(heap != nullptr);
+    *heap = 0;
+    for (void *foreign : {(void*)&local, (void*)heap, (void*)&global_object}) {
+        CHECK(slab_lookup(foreign) == nullptr);
+        CHECK(slab_usable_size(foreign) == 0);
+        slab_free(foreign);
+    }
+    CHECK(local == 0 && *heap == 0 && global_object == 0);
+    free(heap);
+
+    // objects of any cache go back through slab_free
+    slab_free(object);
+    cache_shrink(&cache);
+    CHECK(used_slabs(&cache) == 0);
+    CHECK(slab_lookup(object) == nullptr);
+    cache_release(&cache);
+}
+
+/**
+ * SLAB_CONCURRENT: threads free objects of each other's SLABs
+ * while their owners keep allocating, no object is handed out
+ * twice and every SLAB comes back after the threads finished
+ **/
+void check_concurrent() {
+    struct cache cache{};
+    cache_setup_ex(&cache, 64, 0, SLAB_CONCURRENT, nullptr, nullptr);
+    // mmap keeps to 47 bit addresses without a hint past them, the stacks stay on
+    CHECK(cache.flags & SLAB_CONCURRENT);
+
+    const size_t threads = 4;
+    const size_t count = 20000;
+    std::vector<std::vector<size_t*>> objects(threads);
+    std::vector<std::thread> workers;
+    for (size_t t = 0; t < threads; ++t) {
+        workers.emplace_back([&cache, &objects, t, count] {
+            for (size_t i = 0; i < count; ++i) {
+                auto object = (size_t*)cache_alloc(&cache);
+                CHECK(object != nullptr);
+                *object = t * count + i;
+                objects[t].push_back(object);
+            }
+        });
+    }
+    for (auto &worker : workers) {
+        worker.join();
+    }
+    workers.clear();
+
+    std::vector<size_t*> all;
+    for (auto &list : objects) {
+        all.insert(all.end(), list.begin(), list.end());
+    }
+    std::sort(all.begin(), all.end());
+    CHECK(std::adjacent_find(all.begin(), all.end()) == all.end());
+
+    // every free is of another thread's object, while the threads allocate too
+    std::vector<std::vector<size_t*>> kept(threads);
+    for (size_t t = 0; t < threads; ++t) {
+        workers.emplace_back([&cache, &objects, &kept, t, count] {
+            auto &other = objects[(t + 1) % threads];
+            for (size_t i = 0; i < count; ++i) {
+                CHECK(*other[i] == (t + 1) % threads * count + i);
+                cache_free(&cache, other[i]);
+                if (i % 2) {
+                    auto object = (size_t*)cache_alloc(&cache);
+                    CHECK(object != nullptr);
+                    *object = t;
+                    kept[t].push_back(object);
+                }
+            }
+            for (auto object : kept[t]) {
+                CHECK(*object == t);
+                cache_free(&cache, object);
+            }
+        });
+    }
+    for (auto &worker : workers) {
+        worker.join();
+    }
+
+    CHECK(stats_of(&cache).corruptions == 0);
+    cache_shrink(&cache);
+    CHECK(used_slabs(&cache) == 0);
+    cache_release(&cache);
+}
+
+/**
+ * cache_alloc_contiguous/cache_free_contiguous: runs are adjacent
+ * slots, bad lengths are refused, runs not starting at a slot or
+ * leaving their 64 object word are reported and dropped
+ **/
+void check_contiguous() {
+    struct cache cache{};
+    cache_setup_ex(&cache, 16, 0, SLAB_BITMAP, nullptr, nullptr);
+    CHECK(stats_of(&cache).slab_objects > 64);
+
+    CHECK(cache_alloc_contiguous(&cache, 0) == nullptr);
+    CHECK(cache_alloc_contiguous(&cache, 65) == nullptr);
+    auto run = (uint8_t*)cache_alloc_contiguous(&cache, 64);
+    CHECK(run != nullptr);
+    CHECK(slab_lookup(run) == slab_lookup(run + 63 * 16));
+    auto small = (uint8_t*)cache_alloc_contiguous(&cache, 8);
+    CHECK(small != nullptr && (small >= run + 64 * 16 || small + 8 * 16 <= run));
+
+    cache_free_contiguous(&cache, run, 0);
+    cache_free_contiguous(&cache, run, 65);
+    CHECK(stats_of(&cache).corruptions == 0);
+    cache_free_contiguous(&cache, run + 8 * 16, 64);
+    cache_free_contiguous(&cache, run + 1, 8);
+    int foreign[4];
+    cache_free_contiguous(&cache, foreign, 4);
+    CHECK(stats_of(&cache).corruptions == 3);
+
+    // a run may go back one object at a time as well
+    cache_free_contiguous(&cache, run, 64);
+    for (size_t i = 0; i < 8; ++i) {
+        cache_free(&cache, small + i * 16);
+    }
+    CHECK(stats_of(&cache).corruptions == 3);
+    cache_shrink(&cache);
+    CHECK(used_slabs(&cache) == 0);
+
+    struct cache list{};
+    cache_setup(&list, 16);
+    CHECK(cache_alloc_contiguous(&list, 4) == nullptr);
+    cache_release(&list);
+    cache_release(&cache);
+}
+
+/**
+ * The SLAB cursor: allocations stay on the SLAB of the previous
+ * one while it is partial, fuller SLABs wait until it fills up,
+ * and a released SLAB leaves the cursor
+ **/
+void check_cursor() {
+    struct cache cache{};
+    cache_setup(&cache, 64);
+
+    size_t per_slab = stats_of(&cache).slab_objects;
+    std::vector<void*> objects(2 * per_slab);
+    CHECK(cache_alloc_bulk(&cache, objects.data(), objects.size()) == objects.size());
+    auto first = slab_lookup(objects[0]);
+    auto second = slab_lookup(objects[per_slab]);
+    CHECK(first != second && slab_lookup(objects.back()) == second);
+
+    // the first SLAB misses one object, the second, the cursor, half of them
+    cache_free_bulk(&cache, &objects[0], 1);
+    cache_free_bulk(&cache, &objects[per_slab], per_slab / 2);
+
+    std::vector<void*> again(per_slab / 2 + 1);
+    CHECK(cache_alloc_bulk(&cache, again.data(), again.size()) == again.size());
+    for (size_t i = 0; i < per_slab / 2; ++i) {
+        CHECK(slab_lookup(again[i]) == second);
+    }
+    CHECK(again.back() == objects[0]);
+
+    objects[0] = again.back();
+    std::copy(again.begin(), again.end() - 1, objects.begin() + per_slab);
+    cache_free_bulk(&cache, objects.data(), objects.size());
+    cache_shrink(&cache);
+    CHECK(used_slabs(&cache) == 0);
+    auto object = cache_alloc(&cache);
+    CHECK(object != nullptr);
+    cache_free(&cache, object);
+    cache_release(&cache);
+}
+
+/**
+ * SLAB_POISON alone: frees of objects never written are valid
+ * and give the objects back, a second free is a double free,
+ * a write to a free object is found by its next allocation
+ **/
+void check_poison() {
+    struct cache cache{};
+    cache_setup_ex(&cache, 48, 0, SLAB_POISON, nullptr, nullptr);
+
+    std::vector<void*> objects;
+    for (int i = 0; i < 100; ++i) {
+        objects.push_back(cache_alloc(&cache));
+        CHECK(objects.back() != nullptr);
+    }
+    for (auto object : objects) {
+        cache_free(&cache, object);
+    }
+    CHECK(stats_of(&cache).corruptions == 0);
+
+    cache_free(&cache, objects[0]);
+    CHECK(stats_of(&cache).corruptions == 1);
+
+    // every valid free went back to the SLABs
+    cache_shrink(&cache);
+    CHECK(used_slabs(&cache) == 0);
+    CHECK(stats_of(&cache).free_slabs == 0);
+
+    void *object = cache_alloc(&cache);
+    cache_free(&cache, object);
+    memset(object, 0, 8);
+    CHECK(cache_alloc(&cache) == object);
+    CHECK(stats_of(&cache).corruptions == 2);
+    cache_free(&cache, object);
+    CHECK(stats_of(&cache).corruptions == 2);
+
+    cache_release(&cache);
+}
+
+/**
+ * SLAB_RED_ZONE: double frees, foreign pointers and pointers
+ * into objects are dropped, overflows are reported. A thread
+ * which finished leaves no SLAB behind
+ **/
+void check_red_zone() {
+    for (unsigned flags : {0u, SLAB_BITMAP, SLAB_CONCURRENT}) {
+        struct cache cache{};
+        cache_setup_ex(&cache, 24, 0, SLAB_RED_ZONE | flags, nullptr, nullptr);
+
+        std::thread([&cache] {
+            auto first = (uint8_t*)cache_alloc(&cache);
+            auto second = (uint8_t*)cache_alloc(&cache);
+            CHECK(first && second);
+            CHECK(slab_usable_size(first) == 24);
+            memset(first, 1, 24);
+
+            cache_free(&cache, first);
+            cache_free(&cache, first);
+            CHECK(stats_of(&cache).corruptions == 1);
+
+            int local;
+            cache_free(&cache, &local);
+            cache_free(&cache, second + 4);
+            CHECK(stats_of(&cache).corruptions == 3);
+
+            // an overflow is reported, the object is still freed
+            second[24] = 0;
+            cache_free(&cache, second);
+            CHECK(stats_of(&cache).corruptions == 4);
+        }).join();
+
+        cache_shrink(&cache);
+        CHECK(used_slabs(&cache) == 0);
+        cache_release(&cache);
+    }
+}
+
+/**
+ * SLAB_BITMAP without debug flags: frees skip magazines, so the
+ * bitmap refuses a double free instead of counting the object twice
+ **/
+void check_bitmap_double_free() {
+    struct cache cache{};
+    cache_setup_ex(&cache, 16, 0, SLAB_BITMAP, nullptr, nullptr);
+
+    void *objects[2];
+    CHECK(cache_alloc_bulk(&cache, objects, 2) == 2);
+    cache_free_bulk(&cache, objects, 1);
+    cache_free_bulk(&cache, objects, 1);
+    CHECK(stats_of(&cache).corruptions == 1);
+
+    // cache_free reaches the bitmap as well
+    cache_free(&cache, objects[0]);
+    CHECK(stats_of(&cache).corruptions == 2);
+
+    cache_free_bulk(&cache, objects + 1, 1);
+    cache_shrink(&cache);
+    CHECK(used_slabs(&cache) == 0);
+    cache_release(&cache);
+}
+
+/**
+ * SLAB_FREELIST_HARDENED: a free pointer overwritten by a write
+ * after free is found before it is followed
+ **/
+void check_hardened() {
+#ifdef SLAB_FREELIST_HARDENED
+    struct cache cache{};
+    cache_setup(&cache, 32);
+
+    void *objects[8];
+    CHECK(cache_alloc_bulk(&cache, objects, 8) == 8);
+    cache_free_bulk(&cache, objects, 8);
+
+    // the last object of a run heads the free list
+    memset((uint8_t*)objects[7] + cache.free_offset, 0x41, sizeof(void*));
+    void *again[8];
+    CHECK(cache_alloc_bulk(&cache, again, 8) == 8);
+    CHECK(stats_of(&cache).corruptions == 1);
+    for (auto object : again) {
+        CHECK(slab_lookup(object) != nullptr);
+    }
+    cache_release(&cache);
+#else
+    skip("built without SLAB_FREELIST_HARDENED");
+#endif
+}
+
+/**
+ * Idle lists: with an idle timeout cache_shrink keeps the free
+ * SLABs with their pages given back, allocations take them
+ * again without new SLABs, a timeout of 0 frees them
+ **/
+void check_idle() {
+    struct cache cache{};
+    cache_setup(&cache, 64);
+    cache_set_idle_timeout(&cache, 60000);
+
+    size_t count = 4 * cache.slab_objects;
+    std::vector<void*> objects(count);
+    CHECK(cache_alloc_bulk(&cache, objects.data(), count) == count);
+    cache_free_bulk(&cache, objects.data(), count);
+    cache_shrink(&cache);
+    auto stats = stats_of(&cache);
+    CHECK(stats.idle_slabs == 4 && slabs_of(&cache) == 0);
+
+    CHECK(cache_alloc_bulk(&cache, objects.data(), count) == count);
+    for (auto object : objects) {
+        memset(object, 1, 64);
+    }
+    CHECK(stats_of(&cache).idle_slabs == 0 && used_slabs(&cache) == 4);
+#ifdef SLAB_STATS
+    CHECK(stats_of(&cache).slab_allocs == stats.slab_allocs);
+#endif
+
+    cache_free_bulk(&cache, objects.data(), count);
+    cache_shrink(&cache);
+    CHECK(stats_of(&cache).idle_slabs == 4);
+    cache_set_idle_timeout(&cache, 0);
+    cache_shrink(&cache);
+    CHECK(stats_of(&cache).idle_slabs == 0 && slabs_of(&cache) == 0);
+#ifdef SLAB_STATS
+    CHECK(stats_of(&cache).slab_frees == stats.slab_allocs);
+#endif
+    cache_release(&cache);
+}
+
+/**
+ * cache_attach: objects and the root of a detached file are
+ * there on the next attach, files of another object size
+ * or still attached are refused
+ **/
+void check_persistent() {
+    struct node {
+        node *next;
+        size_t value;
+    };
+
+    char path[] = "/tmp/slab_check_XXXXXX";
+    int fd = mkstemp(path);
+    CHECK(fd >= 0);
+    close(fd);
+    auto base = (void*)0x7e9000000000;
+    size_t size = 16 << 20;
+
+    auto cache = cache_attach(path, sizeof(node), 0, base, size);
+    CHECK(cache != nullptr);
+    node *head = nullptr;
+    for (size_t i = 0; i < 100; ++i) {
+        auto item = (node*)cache_alloc(cache);
+        CHECK(item != nullptr);
+        *item = {head, i};
+        head = item;
+    }
+    *cache_root(cache) = head;
+    CHECK(cache_attach(path, sizeof(node), 0, base, size) == nullptr);
+    cache_detach(cache);
+
+    CHECK(cache_attach(path, 2 * sizeof(node), 0, base, size) == nullptr);
+    // another thread attaches the file: the SLABs in use become its own and its frees reach them at once
+    std::thread([&] {
+        auto cache = cache_attach(path, sizeof(node), 0, base, size);
+        CHECK(cache != nullptr);
+        size_t count = 0;
+        for (auto item = (node*)*cache_root(cache); item; item = item->next) {
+            CHECK(item->value == 99 - count);
+            count += 1;
+        }
+        CHECK(count == 100);
+
+        // the SLABs of the file serve and take objects again
+        while (head) {
+            auto next = head->next;
+            cache_free(cache, head);
+            head = next;
+        }
+        CHECK(used_slabs(cache) == 0);
+        auto object = cache_alloc(cache);
+        CHECK(object != nullptr && slab_lookup(object) != nullptr);
+        cache_free(cache, object);
+        cache_shrink(cache);
+        CHECK(used_slabs(cache) == 0);
+        cache_detach(cache);
+    }).join();
+    unlink(path);
+}
+
+/**
+ * cache_attach with an idle timeout: idle SLABs of the file give
+ * their pages back by punching holes and serve objects again
+ **/
+void check_persistent_idle() {
+    char path[] = "/tmp/slab_check_XXXXXX";
+    int fd = mkstemp(path);
+    CHECK(fd >= 0);
+    close(fd);
+
+    size_t object_size = 2048;
+    auto cache = cache_attach(path, object_size, 0, (void*)0x7e9000000000, 16 << 20);
+    CHECK(cache != nullptr);
+    CHECK(stats_of(cache).slab_size > 4096);
+    cache_set_idle_timeout(cache, 60000);
+
+    std::vector<void*> objects;
+    for (int i = 0; i < 256; ++i) {
+        objects.push_back(cache_alloc(cache));
+        CHECK(objects.back() != nullptr);
+        memset(objects.back(), 1, object_size);
+    }
+    struct stat written;
+    CHECK(stat(path, &written) == 0);
+
+    for (auto object : objects) {
+        cache_free(cache, object);
+    }
+    cache_shrink(cache);
+    CHECK(stats_of(cache).idle_slabs > 0);
+    struct stat shrunk;
+    CHECK(stat(path, &shrunk) == 0);
+    CHECK(shrunk.st_blocks < written.st_blocks);
+
+    for (auto &object : objects) {
+        object = cache_alloc(cache);
+        CHECK(object != nullptr);
+        memset(object, 2, object_size);
+    }
+    CHECK(stats_of(cache).idle_slabs == 0);
+    for (auto object : objects) {
+        cache_free(cache, object);
+    }
+    cache_detach(cache);
+    unlink(path);
+}
+
+struct named_check {
+    const char *name;
+    void (*run)();
+};
+
+const named_check checks[] = {
+    {"free_list", check_free_list},
+    {"full_slab", check_full_slab},
+    {"slab_order", check_slab_order},
+    {"magazines", check_magazines},
+    {"rseq", check_rseq},
+    {"remote_free", check_remote_free},
+    {"bulk", check_bulk},
+    {"size_classes", check_size_classes},
+    {"buddy", check_buddy},
+    {"hugepage", check_hugepage},
+    {"numa_node", check_numa_node},
+    {"colour", check_colour},
+    {"alignment", check_alignment},
+    {"ctor_dtor", check_ctor_dtor},
+    {"slab_cache", check_slab_cache},
+    {"static_slab_cache", check_static_slab_cache},
+    {"shrink_budget", check_shrink_budget},
+    {"reclaimer", check_reclaimer},
+    {"defrag", check_defrag},
+    {"stats_dump", check_stats_dump},
+    {"trace", check_trace},
+    {"lookup", check_lookup},
+    {"concurrent", check_concurrent},
+    {"contiguous", check_contiguous},
+    {"cursor", check_cursor},
+    {"poison", check_poison},
+    {"red_zone", check_red_zone},
+    {"bitmap_double_free", check_bitmap_double_free},
+    {"hardened", check_hardened},
+    {"idle", check_idle},
+    {"persistent", check_persistent},
+    {"persistent_idle", check_persistent_idle},
+};
+
+int main(int argc, char **argv) {
+    if (argc != 2 && argc != 3) {
+        fprintf(stderr, "usage: %s <check> [argument]\n", argv[0]);
+        return 2;
+    }
+    check_argument = argc == 3 ? argv[2] : nullptr;
+    for (auto &check : checks) {
+        if (strcmp(check.name, argv[1]) == 0) {
+            check.run();
+            return 0;
+        }
+    }
+    fprintf(stderr, "unknown check %s\n", argv[1]);
+    return 2;
+}
@@ -0,0 +1,111 @@
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <list>
+#include <memory_resource>
+#include <vector>
+
+#include "slab_resource.h"
+
+/**
+ * Checks of SlabMemoryResource, the C++17 counterpart of
+ * slab_check: exits with 1 on the first failed expectation
+ **/
+
+#define CHECK(condition) check((condition), #condition, __FILE__, __LINE__)
+
+void check(bool condition, const char *text, const char *file, int line) {
+    if (!condition) {
+        fprintf(stderr, "%s:%d: check failed: %s\n", file, line, text);
+        exit(1);
+    }
+}
+
+/**
+ * Upstream resource counting the bytes it holds
+ **/
+class counting_resource : public std::pmr::memory_resource {
+public:
+    size_t held = 0;
+
+protected:
+    void *do_allocate(size_t bytes, size_t alignment) override {
+        held += bytes;
+        return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+    }
+
+    void do_deallocate(void *pointer, size_t bytes, size_t alignment) override {
+        held -= bytes;
+        std::pmr::new_delete_resource()->deallocate(pointer, bytes, alignment);
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override {
+        return this == &other;
+    }
+};
+
+bool aligned(void *pointer, size_t alignment) {
+    return (uintptr_t)pointer % alignment == 0;
+}
+
+int main() {
+    counting_resource upstream;
+    SlabMemoryResource resource(&upstream);
+
+    // containers take their nodes and arrays from SLABs
+    {
+        std::pmr::vector<int> numbers(&resource);
+        std::pmr::list<int> list(&resource);
+        for (int i = 0; i < 10000; ++i) {
+            numbers.push_back(i);
+            list.push_back(i);
+        }
+        CHECK(slab_lookup(numbers.data()) != nullptr);
+        CHECK(slab_lookup(&list.front()) != nullptr);
+        int expected = 0;
+        for (int value : list) {
+            CHECK(value == numbers[expected++]);
+        }
+        CHECK(upstream.held == 0);
+    }
+
+    // alignments up to a SLAB are served by SLABs
+    for (size_t alignment : {16, 64, 256, 4096}) {
+        for (size_t bytes : {1, 24, 100, 5000}) {
+            void *memory = resource.allocate(bytes, alignment);
+            CHECK(aligned(memory, alignment));
+            CHECK(slab_lookup(memory) != nullptr);
+            CHECK(slab_usable_size(memory) >= bytes);
+            resource.deallocate(memory, bytes, alignment);
+        }
+    }
+    CHECK(upstream.held == 0);
+
+    // over-aligned small objects take the power of two size class of their alignment, not a SLAB
+    struct alignas(128) line_pair {
+        char bytes[64];
+    };
+    std::pmr::polymorphic_allocator<line_pair> pairs(&resource);
+    line_pair *pair = pairs.allocate(1);
+    CHECK(aligned(pair, 128));
+    CHECK(slab_usable_size(pair) == 128);
+    pairs.deallocate(pair, 1);
+    for (size_t alignment = 128; alignment <= 4096; alignment <<= 1) {
+        void *memory = resource.allocate(24, alignment);
+        CHECK(aligned(memory, alignment));
+        CHECK(slab_usable_size(memory) == alignment);
+        resource.deallocate(memory, 24, alignment);
+    }
+    CHECK(upstream.held == 0);
+
+    // requests past a SLAB go upstream until release
+    void *large = resource.allocate(max_slab_malloc_size + 1, 8);
+    CHECK(slab_lookup(large) == nullptr);
+    CHECK(upstream.held > max_slab_malloc_size);
+    resource.deallocate(large, max_slab_malloc_size + 1, 8);
+    CHECK(upstream.held > max_slab_malloc_size);
+    resource.release();
+    CHECK(upstream.held == 0);
+
+    return 0;
+}
@@ -0,0 +1,213 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "slab.h"
+
+/* fragmentation samples printed over the replay by default */
+const size_t default_samples = 20;
+
+/**
+ * A cache of the trace and the bytes its live objects asked for
+ **/
+struct replay_cache {
+    struct cache *cache;
+    size_t object_size;
+    size_t live_bytes;
+};
+
+struct replay_object {
+    void *pointer;
+    uint16_t cache;
+};
+
+std::vector<trace_record> read_trace(const char *path) {
+    std::vector<trace_record> records;
+
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        perror(path);
+        return records;
+    }
+
+    char magic[sizeof(trace_magic)];
+    if (fread(magic, sizeof(magic), 1, file) != 1 || memcmp(magic, trace_magic, sizeof(magic)) != 0) {
+        fprintf(stderr, "%s: not a trace of slab_trace_start\n", path);
+        fclose(file);
+        return records;
+    }
+
+    trace_record record;
+    size_t length;
+    while ((length = fread(&record, 1, sizeof(record), file)) == sizeof(record)) {
+        records.push_back(record);
+    }
+    fclose(file);
+
+    // a trace cut inside a record was not stopped by slab_trace_stop
+    if (length) {
+        fprintf(stderr, "%s: truncated after %zu records\n", path, records.size());
+        records.clear();
+    }
+    return records;
+}
+
+/**
+ * SLAB bytes held by all caches not released yet
+ **/
+size_t slab_bytes(std::vector<replay_cache> &caches) {
+    size_t bytes = 0;
+    for (auto &cache : caches) {
+        if (cache.cache) {
+            cache_statistics stats;
+            cache_stats(cache.cache, &stats);
+            bytes += (stats.full_slabs + stats.partial_slabs + stats.free_slabs) * stats.slab_size;
+        }
+    }
+    return bytes;
+}
+
+uint64_t slab_allocs(struct cache *cache) {
+    cache_statistics stats;
+    cache_stats(cache, &stats);
+    return stats.slab_allocs;
+}
+
+/**
+ * Replays a trace of slab_trace_start against cache_alloc,
+ * cache_free and cache_shrink as fast as possible, printing
+ * the share of SLAB memory not used by live objects over
+ * the trace, the throughput and the count of alloc_slab calls
+ **/
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <trace> [samples]\n", argv[0]);
+        return 2;
+    }
+
+    auto records = read_trace(argv[1]);
+    if (records.empty()) {
+        return 1;
+    }
+    size_t samples = argc > 2 ? strtoul(argv[2], nullptr, 10) : default_samples;
+    size_t interval = samples ? (records.size() + samples - 1) / samples : records.size() + 1;
+
+    std::vector<replay_cache> caches;
+    std::vector<replay_object> objects;
+    uint64_t total_slab_allocs = 0;
+    size_t live_bytes = 0;
+    size_t peak_slab_bytes = 0;
+    size_t failed = 0;
+    std::chrono::steady_clock::duration elapsed{};
+
+    printf("# %zu records\n", records.size());
+    printf("# %12s %14s %14s %14s\n", "trace_ms", "live_bytes", "slab_bytes", "fragmentation");
+
+    auto started = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < records.size(); ++i) {
+        auto &record = records[i];
+
+        // damaged or cut traces must not index past the tables
+        if (record.op != trace_setup && (record.cache >= caches.size() || !caches[record.cache].cache)) {
+            fprintf(stderr, "record %zu: cache %u has no setup record\n", i, record.cache);
+            return 1;
+        }
+        if (record.op == trace_free &&
+            (record.object >= objects.size() || (objects[record.object].pointer &&
+                                                 objects[record.object].cache != record.cache))) {
+            fprintf(stderr, "record %zu: object %u of cache %u was never allocated\n", i, record.object,
+                    record.cache);
+            return 1;
+        }
+
+        switch (record.op) {
+        case trace_setup:
+            if (record.cache >= caches.size()) {
+                caches.resize(record.cache + 1, replay_cache{nullptr, 0, 0});
+            }
+            caches[record.cache].cache = new cache();
+            caches[record.cache].object_size = record.object & (((uint32_t)1 << trace_align_shift) - 1);
+            cache_setup_ex(caches[record.cache].cache, caches[record.cache].object_size,
+                           (size_t)1 << (record.object >> trace_align_shift), record.flags, nullptr, nullptr);
+            break;
+        case trace_alloc:
+            if (record.object >= objects.size()) {
+                objects.resize(record.object + 1, replay_object{nullptr, 0});
+            }
+            objects[record.object].pointer = cache_alloc(caches[record.cache].cache);
+            objects[record.object].cache = record.cache;
+            if (objects[record.object].pointer) {
+                caches[record.cache].live_bytes += caches[record.cache].object_size;
+                live_bytes += caches[record.cache].object_size;
+            } else {
+                failed += 1;
+            }
+            break;
+        case trace_free:
+            if (auto pointer = objects[record.object].pointer) {
+                cache_free(caches[record.cache].cache, pointer);
+                objects[record.object].pointer = nullptr;
+                caches[record.cache].live_bytes -= caches[record.cache].object_size;
+                live_bytes -= caches[record.cache].object_size;
+            }
+            break;
+        case trace_shrink:
+            cache_shrink(caches[record.cache].cache);
+            break;
+        case trace_release:
+            // live objects of the cache go away with it
+            total_slab_allocs += slab_allocs(caches[record.cache].cache);
+            cache_release(caches[record.cache].cache);
+            delete caches[record.cache].cache;
+            caches[record.cache].cache = nullptr;
+            live_bytes -= caches[record.cache].live_bytes;
+            caches[record.cache].live_bytes = 0;
+            for (auto &object : objects) {
+                if (object.pointer && object.cache == record.cache) {
+                    object.pointer = nullptr;
+                }
+            }
+            break;
+        default:
+            fprintf(stderr, "record %zu: unknown operation %u\n", i, record.op);
+            return 1;
+        }
+
+        if ((i + 1) % interval == 0 || i + 1 == records.size()) {
+            elapsed += std::chrono::steady_clock::now() - started;
+
+            size_t bytes = slab_bytes(caches);
+            peak_slab_bytes = std::max(peak_slab_bytes, bytes);
+            printf("  %12.3f %14zu %14zu %13.1f%%\n", record.timestamp / 1e6, live_bytes, bytes,
+                   bytes ? 100.0 * (double)(bytes - std::min(bytes, live_bytes)) / (double)bytes : 0.0);
+
+            started = std::chrono::steady_clock::now();
+        }
+    }
+
+    for (auto &cache : caches) {
+        if (cache.cache) {
+            total_slab_allocs += slab_allocs(cache.cache);
+            cache_release(cache.cache);
+            delete cache.cache;
+        }
+    }
+
+    double seconds = std::chrono::duration<double>(elapsed).count();
+    printf("replayed %zu records in %.3f s, %.2f Mops/s\n", records.size(), seconds,
+           seconds > 0 ? (double)records.size() / seconds / 1e6 : 0.0);
+#ifdef SLAB_STATS
+    printf("alloc_slab calls %llu, peak SLAB memory %zu bytes\n", (unsigned long long)total_slab_allocs,
+           peak_slab_bytes);
+#else
+    printf("alloc_slab calls are not counted without SLAB_STATS, peak SLAB memory %zu bytes\n", peak_slab_bytes);
+#endif
+    if (failed) {
+        printf("%zu allocations failed\n", failed);
+    }
+
+    return 0;
+}
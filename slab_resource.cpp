@@ -0,0 +1,64 @@
+#include <algorithm>
+#include <new>
+
+#include "slab_resource.h"
+
+/**
+ * Size to ask slab_malloc for, so the memory it returns is
+ * aligned on `alignment`: size classes past 8 bytes are aligned
+ * at least on 16 bytes, those of a power of two size on their
+ * size up to a page, and the SLABs of larger requests on
+ * their size. Returns 0 if no SLAB can serve the request
+ **/
+size_t slab_request_size(size_t bytes, size_t alignment) {
+    size_t size = std::max(bytes, (size_t)1);
+    if (alignment <= alignof(void*)) {
+        // every size class is aligned at least on a pointer
+    } else if (alignment <= 16) {
+        size = std::max(size, (size_t)16);
+    } else if (alignment <= 4096 && bytes <= max_size_class) {
+        size = alignment;
+        while (size < bytes) {
+            size <<= 1;
+        }
+    } else {
+        size = std::max({size, alignment, max_size_class + 1});
+    }
+    return size <= max_slab_malloc_size ? size : 0;
+}
+
+SlabMemoryResource::SlabMemoryResource(std::pmr::memory_resource *upstream) : oversize_(upstream) {}
+
+void SlabMemoryResource::release() {
+    std::lock_guard<std::mutex> guard(oversize_lock_);
+    oversize_.release();
+}
+
+void *SlabMemoryResource::do_allocate(size_t bytes, size_t alignment) {
+    if (size_t size = slab_request_size(bytes, alignment)) {
+        void *memory = slab_malloc(size);
+        if (!memory) {
+            throw std::bad_alloc();
+        }
+        return memory;
+    }
+
+    std::lock_guard<std::mutex> guard(oversize_lock_);
+    return oversize_.allocate(bytes, alignment);
+}
+
+void SlabMemoryResource::do_deallocate(void *pointer, size_t, size_t) {
+    // the page map tells memory of SLABs apart, the monotonic buffer frees nothing before release
+    if (slab_lookup(pointer)) {
+        slab_free(pointer);
+    }
+}
+
+bool SlabMemoryResource::do_is_equal(const std::pmr::memory_resource &other) const noexcept {
+    return this == &other;
+}
+
+SlabMemoryResource *slab_memory_resource() {
+    static auto resource = new SlabMemoryResource();
+    return resource;
+}
@@ -0,0 +1,48 @@
+#ifndef SLAB_ALLOCATOR_SLAB_RESOURCE_H
+#define SLAB_ALLOCATOR_SLAB_RESOURCE_H
+
+#include <memory_resource>
+#include <mutex>
+
+#include "slab.h"
+
+/**
+ * std::pmr::memory_resource taking memory from the size class
+ * caches of slab_malloc, so pmr containers allocate from SLABs
+ * without changes of their call sites. Requests aligned on up
+ * to a page take the power of two size class covering both their
+ * size and alignment, so an over-aligned object costs at most its
+ * alignment. Requests over max_slab_malloc_size or aligned on
+ * more come from a monotonic buffer of the upstream resource,
+ * freed when the resource is destroyed or released. Thread safe
+ **/
+class SlabMemoryResource : public std::pmr::memory_resource {
+public:
+    explicit SlabMemoryResource(std::pmr::memory_resource *upstream = std::pmr::new_delete_resource());
+
+    SlabMemoryResource(const SlabMemoryResource &) = delete;
+    SlabMemoryResource &operator=(const SlabMemoryResource &) = delete;
+
+    /**
+     * Gives the oversize requests back to the upstream resource,
+     * memory from SLABs is not touched
+     **/
+    void release();
+
+protected:
+    void *do_allocate(size_t bytes, size_t alignment) override;
+    void do_deallocate(void *pointer, size_t bytes, size_t alignment) override;
+    bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override;
+
+private:
+    std::mutex oversize_lock_;
+    std::pmr::monotonic_buffer_resource oversize_; /* requests the SLABs can't serve, under oversize_lock_ */
+};
+
+/**
+ * The resource shared by the whole program, never destroyed
+ * like the size class caches behind it
+ **/
+SlabMemoryResource *slab_memory_resource();
+
+#endif //SLAB_ALLOCATOR_SLAB_RESOURCE_H